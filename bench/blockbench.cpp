@@ -0,0 +1,171 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "map.hpp"
+#include "genericastar.h"
+
+//Compares A* and jump point search for paths inside a block: tiles expanded and time.
+//Usage: blockbench [map file...], test.map if none are given.
+
+namespace
+{
+	static const size_t BlockSize = 16;
+	static const size_t Queries = 20000;
+
+	//A side × side map in the format of Map::loadFromStream, with the given share of walls.
+	std::string randomMap(size_t side, double blocked, unsigned seed)
+	{
+		std::mt19937 random(seed);
+		std::bernoulli_distribution wall(blocked);
+
+		std::string result;
+		for (size_t y = 0; y < side; ++y)
+		{
+			for (size_t x = 0; x < side; ++x)
+			{
+				result += wall(random) ? '0' : '1';
+			}
+
+			result += '\n';
+		}
+
+		return result;
+	}
+
+	//Costs the tiles walked, or NoPath when they are not a connected walk.
+	size_t walkCost(const std::vector<Index>& path)
+	{
+		size_t cost = 0;
+		for (size_t i = 1; i < path.size(); ++i)
+		{
+			int dx = std::abs(int(path[i].x) - int(path[i - 1].x));
+			int dy = std::abs(int(path[i].y) - int(path[i - 1].y));
+			if (dx > 1 || dy > 1 || dx + dy == 0)
+			{
+				return Pathfinder::NoPath;
+			}
+
+			cost += (dx && dy) ? 3 : 2;
+		}
+
+		return cost;
+	}
+
+	void run(const std::string& name, std::istream& input, size_t size)
+	{
+		Map map;
+		map.setRouteCacheCapacity(0);
+		map.loadFromStream(input);
+
+		std::vector<Index> open;
+		for (boost::uint16_t y = 0; y < map.rows(); ++y)
+		{
+			for (boost::uint16_t x = 0; x < map.columns(); ++x)
+			{
+				if (map.passable(Index(x, y), Layers::Ground) >= size)
+				{
+					open.push_back(Index(x, y));
+				}
+			}
+		}
+
+		if (open.empty())
+		{
+			std::cout << name << ": no open tiles\n";
+			return;
+		}
+
+		//Pairs of open tiles in the same block.
+		std::mt19937 random(7);
+		std::vector<OriginAndGoal> pairs;
+		while (pairs.size() < Queries)
+		{
+			OriginAndGoal q;
+			q.origin = open[random() % open.size()];
+			q.goal = Index(q.origin.x - q.origin.x % BlockSize + random() % BlockSize, q.origin.y - q.origin.y % BlockSize + random() % BlockSize);
+			if (q.goal.x < map.columns() && q.goal.y < map.rows() && map.passable(q.goal, Layers::Ground) >= size)
+			{
+				pairs.push_back(q);
+			}
+		}
+
+		const BlockSearch methods[] = { AStarBlockSearch, JumpPointBlockSearch };
+		const char * names[] = { "A*", "JPS" };
+		std::vector<size_t> lengths[2];
+		size_t expanded[2] = { 0, 0 };
+		double seconds[2];
+		size_t broken = 0;
+
+		std::vector<Index> path;
+		for (size_t m = 0; m < 2; ++m)
+		{
+			map.setBlockSearch(methods[m]);
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < pairs.size(); ++i)
+			{
+				size_t count = 0;
+				lengths[m].push_back(map.blockPath(pairs[i].origin, pairs[i].goal, size, GROUND, &path, &count));
+				expanded[m] += count;
+
+				if (lengths[m].back() != Pathfinder::NoPath && walkCost(path) != lengths[m].back())
+				{
+					++broken;
+				}
+			}
+
+			seconds[m] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		}
+
+		std::cout << name << ", size " << size << "\n";
+		for (size_t m = 0; m < 2; ++m)
+		{
+			std::cout << "  " << names[m] << ": " << double(expanded[m]) / pairs.size() << " tiles expanded per query, "
+				<< seconds[m] * 1e6 / pairs.size() << " us per query\n";
+		}
+
+		std::cout << "  " << double(expanded[0]) / std::max<size_t>(expanded[1], 1) << "x fewer expansions"
+			<< (lengths[0] == lengths[1] ? "" : ", LENGTHS DIFFER") << (broken ? ", BROKEN PATHS" : "") << "\n";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i)
+	{
+		files.push_back(argv[i]);
+	}
+
+	if (files.empty())
+	{
+		files.push_back("test.map");
+	}
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		std::ifstream input(files[i].c_str());
+		if (!input)
+		{
+			std::cout << "Could not load " << files[i] << "\n";
+			continue;
+		}
+
+		run(files[i], input, 1);
+	}
+
+	const double blocked[] = { 0.0, 0.1, 0.3 };
+	for (size_t i = 0; i < 3; ++i)
+	{
+		for (size_t size = 1; size <= 2; ++size)
+		{
+			std::istringstream input(randomMap(256, blocked[i], unsigned(i + 1)));
+			run("random 256^2, " + std::to_string(int(blocked[i] * 100)) + "% blocked", input, size);
+		}
+	}
+}
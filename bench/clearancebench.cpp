@@ -0,0 +1,150 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "clearance.h"
+
+//Compares the per-tile clearance scan with the row transform.
+//Usage: clearancebench [map file...], test.map if none are given.
+
+namespace
+{
+	static const size_t MaximumWidth = 7;
+
+	struct Grid
+	{
+		std::string name;
+		size_t width;
+		size_t height;
+		std::vector<boost::uint8_t> tiles;
+	};
+
+	//Same format as Map::loadFromStream, every character but '0' is passable.
+	bool loadGrid(const char * file, Grid& grid)
+	{
+		std::ifstream input(file);
+		std::string line;
+
+		grid.name = file;
+		grid.width = 0;
+		grid.height = 0;
+		grid.tiles.clear();
+		while (std::getline(input, line))
+		{
+			size_t before = grid.tiles.size();
+			for (size_t i = 0; i < line.size(); ++i)
+			{
+				if (line[i] != '|' && line[i] != '-' && line[i] != '\r')
+				{
+					grid.tiles.push_back(line[i] != '0');
+				}
+			}
+
+			//Rows of separators only are skipped.
+			if (grid.tiles.size() == before)
+			{
+				continue;
+			}
+
+			grid.width = grid.tiles.size() - before;
+			++grid.height;
+		}
+
+		return grid.height > 0 && grid.tiles.size() == grid.width * grid.height;
+	}
+
+	Grid randomGrid(size_t side, double blocked, unsigned seed)
+	{
+		std::mt19937 random(seed);
+		std::bernoulli_distribution wall(blocked);
+
+		Grid grid;
+		grid.name = "random " + std::to_string(side) + "^2, " + std::to_string(int(blocked * 100)) + "% blocked";
+		grid.width = side;
+		grid.height = side;
+		grid.tiles.resize(side * side);
+		for (size_t i = 0; i < grid.tiles.size(); ++i)
+		{
+			grid.tiles[i] = wall(random) ? 0 : 1;
+		}
+
+		return grid;
+	}
+
+	template<typename F>
+	double bestOf(size_t runs, F f)
+	{
+		double best = 1e100;
+		for (size_t i = 0; i < runs; ++i)
+		{
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			f();
+			best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+		}
+
+		return best;
+	}
+
+	void run(const Grid& grid)
+	{
+		size_t count = grid.tiles.size();
+		std::vector<boost::uint8_t> scanned(count);
+		std::vector<boost::uint8_t> transformed(count);
+
+		//Repeat small maps so the timings mean something.
+		size_t runs = std::max<size_t>(3, (1 << 24) / count);
+
+		double scanTime = bestOf(runs, [&]()
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				scanned[i] = static_cast<boost::uint8_t>(Pathfinder::scanClearance(&grid.tiles[0], grid.width, grid.height, i, MaximumWidth));
+			}
+		});
+
+		double transformTime = bestOf(runs, [&]()
+		{
+			Pathfinder::computeClearance(&grid.tiles[0], &transformed[0], grid.width, grid.height, 0, grid.height, MaximumWidth);
+		});
+
+		std::cout << grid.name << " (" << grid.width << "x" << grid.height << ")\n"
+			<< "  scan:      " << scanTime * 1000 << " ms, " << count / scanTime / 1e6 << " Mtiles/s\n"
+			<< "  transform: " << transformTime * 1000 << " ms, " << count / transformTime / 1e6 << " Mtiles/s\n"
+			<< "  speedup " << scanTime / transformTime << (scanned == transformed ? "" : ", RESULTS DIFFER") << "\n";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i)
+	{
+		files.push_back(argv[i]);
+	}
+
+	if (files.empty())
+	{
+		files.push_back("test.map");
+	}
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		Grid grid;
+		if (loadGrid(files[i].c_str(), grid))
+		{
+			run(grid);
+		}
+		else
+		{
+			std::cout << "Could not load " << files[i] << "\n";
+		}
+	}
+
+	run(randomGrid(4096, 0.0, 1));
+	run(randomGrid(4096, 0.1, 2));
+	run(randomGrid(4096, 0.4, 3));
+}
@@ -0,0 +1,542 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "map.hpp"
+#include "genericastar.h"
+#include "clearance.h"
+#include "stackalloc.h"
+
+//Micro-benchmarks of the preprocessing and query hot paths on maps generated from a seed.
+//Every benchmark reports the best of several runs and a checksum of its results, so a
+//regression in speed or in results shows up when two JSON reports are compared.
+//Usage: pathbench [--side tiles] [--seed n] [--runs n] [--json file], pathbench.json by default.
+
+//Reaches the preprocessing steps of Map that are private.
+struct MapBenchmark
+{
+	static size_t blockCount(const Map& map)
+	{
+		return map.blockCount();
+	}
+
+	static void createBlockData(const Map& map, size_t index, Block& block, std::vector<GraphVertex>& exits)
+	{
+		map.createBlockData(index, block, exits);
+	}
+
+	//A block as innerblockPathfind receives it during preprocessing.
+	static void prepareBlock(const Map& map, size_t index, Block& block)
+	{
+		std::vector<GraphVertex> exits;
+		map.createBlockData(index, block, exits);
+		map.simplifyBlockPortals(block);
+		map.buildPortalTable(block);
+	}
+
+	static void innerblockPathfind(const Map& map, const Block& block, std::vector<GraphVertex>& inner)
+	{
+		map.innerblockPathfind(block, inner);
+	}
+};
+
+namespace
+{
+	static const size_t MaximumWidth = 7;
+
+	struct Options
+	{
+		size_t side;
+		unsigned seed;
+		size_t runs;
+		std::string json;
+	};
+
+	//One tile character per tile, in the format of Map::loadFromText.
+	struct Terrain
+	{
+		std::string name;
+		size_t side;
+		std::vector<char> tiles;
+
+		std::string text() const
+		{
+			std::string result;
+			result.reserve(tiles.size() + side);
+			for (size_t y = 0; y < side; ++y)
+			{
+				result.append(&tiles[y * side], side);
+				result += '\n';
+			}
+
+			return result;
+		}
+	};
+
+	Terrain openField(size_t side, std::mt19937&)
+	{
+		Terrain terrain = { "open", side, std::vector<char>(side * side, '.') };
+		return terrain;
+	}
+
+	Terrain randomObstacles(size_t side, std::mt19937& random)
+	{
+		Terrain terrain = { "random", side, std::vector<char>(side * side, '.') };
+		std::bernoulli_distribution wall(0.25);
+		for (size_t i = 0; i < terrain.tiles.size(); ++i)
+		{
+			if (wall(random))
+			{
+				terrain.tiles[i] = '0';
+			}
+		}
+
+		return terrain;
+	}
+
+	//Corridors one tile wide between the cells at odd coordinates, carved depth first.
+	Terrain maze(size_t side, std::mt19937& random)
+	{
+		Terrain terrain = { "maze", side, std::vector<char>(side * side, '0') };
+		size_t cells = (side - 1) / 2;
+		std::vector<bool> visited(cells * cells, false);
+		std::vector<size_t> stack(1, 0);
+		visited[0] = true;
+		terrain.tiles[1 + side] = '.';
+
+		static const int stepX[] = { 1, -1, 0, 0 };
+		static const int stepY[] = { 0, 0, 1, -1 };
+		while (!stack.empty())
+		{
+			size_t cell = stack.back();
+			int cx = static_cast<int>(cell % cells);
+			int cy = static_cast<int>(cell / cells);
+
+			size_t options[4];
+			size_t count = 0;
+			for (size_t d = 0; d < 4; ++d)
+			{
+				int nx = cx + stepX[d];
+				int ny = cy + stepY[d];
+				if (nx >= 0 && ny >= 0 && nx < int(cells) && ny < int(cells) && !visited[nx + ny * cells])
+				{
+					options[count++] = d;
+				}
+			}
+
+			if (count == 0)
+			{
+				stack.pop_back();
+				continue;
+			}
+
+			size_t d = options[random() % count];
+			size_t next = (cx + stepX[d]) + (cy + stepY[d]) * cells;
+			visited[next] = true;
+			terrain.tiles[(2 * cx + 1 + stepX[d]) + (2 * cy + 1 + stepY[d]) * side] = '.';
+			terrain.tiles[(2 * (cx + stepX[d]) + 1) + (2 * (cy + stepY[d]) + 1) * side] = '.';
+			stack.push_back(next);
+		}
+
+		return terrain;
+	}
+
+	//Rooms of 15 × 15 tiles with a door of 3 tiles to each neighbour. One room in eight is water.
+	Terrain rooms(size_t side, std::mt19937& random)
+	{
+		static const size_t Room = 16;
+		static const size_t Door = 3;
+
+		Terrain terrain = { "rooms", side, std::vector<char>(side * side, '.') };
+		size_t across = side / Room;
+		for (size_t ry = 0; ry < across; ++ry)
+		{
+			for (size_t rx = 0; rx < across; ++rx)
+			{
+				size_t x0 = rx * Room;
+				size_t y0 = ry * Room;
+				char floor = random() % 8 == 0 ? '~' : '.';
+				for (size_t y = y0; y < y0 + Room; ++y)
+				{
+					for (size_t x = x0; x < x0 + Room; ++x)
+					{
+						bool wall = x == x0 || y == y0;
+						terrain.tiles[x + y * side] = wall ? '0' : floor;
+					}
+				}
+
+				//Doors in the top and left walls, to the rooms above and to the left.
+				size_t top = 1 + random() % (Room - Door - 1);
+				size_t left = 1 + random() % (Room - Door - 1);
+				for (size_t i = 0; i < Door; ++i)
+				{
+					if (ry > 0)
+					{
+						terrain.tiles[(x0 + top + i) + y0 * side] = '.';
+					}
+
+					if (rx > 0)
+					{
+						terrain.tiles[x0 + (y0 + left + i) * side] = '.';
+					}
+				}
+			}
+		}
+
+		return terrain;
+	}
+
+	struct Result
+	{
+		std::string name;
+		std::string map;
+		size_t operations;
+		double seconds;
+		boost::uint64_t checksum;
+	};
+
+	//Best time of runs calls of f, which returns a checksum of its results.
+	template<typename F>
+	Result measure(const std::string& name, const std::string& map, size_t operations, size_t runs, F f)
+	{
+		Result result = { name, map, operations, 1e100, 0 };
+		for (size_t i = 0; i < runs; ++i)
+		{
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			result.checksum = f();
+			result.seconds = std::min(result.seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+		}
+
+		std::cout << "  " << name << ": " << result.seconds * 1e9 / std::max<size_t>(operations, 1) << " ns per operation, "
+			<< operations << " operations\n";
+		return result;
+	}
+
+	inline boost::uint64_t mix(boost::uint64_t hash, boost::uint64_t value)
+	{
+		return (hash ^ value) * 1099511628211ULL;
+	}
+
+	std::vector<Index> openTiles(const Map& map)
+	{
+		std::vector<Index> open;
+		for (boost::uint16_t y = 0; y < map.rows(); ++y)
+		{
+			for (boost::uint16_t x = 0; x < map.columns(); ++x)
+			{
+				if (map.passable(Index(x, y), Layers::Ground))
+				{
+					open.push_back(Index(x, y));
+				}
+			}
+		}
+
+		return open;
+	}
+
+	void runTerrain(const Terrain& terrain, const Options& options, std::vector<Result>& results)
+	{
+		std::cout << terrain.name << " (" << terrain.side << "x" << terrain.side << ")\n";
+		size_t tiles = terrain.tiles.size();
+
+		std::vector<boost::uint8_t> passable(tiles);
+		for (size_t i = 0; i < tiles; ++i)
+		{
+			passable[i] = terrain.tiles[i] != '0';
+		}
+
+		std::vector<boost::uint8_t> clearance(tiles);
+		results.push_back(measure("clearance.scan", terrain.name, tiles, options.runs, [&]()
+		{
+			boost::uint64_t sum = 0;
+			for (size_t i = 0; i < tiles; ++i)
+			{
+				sum += Pathfinder::scanClearance(&passable[0], terrain.side, terrain.side, i, MaximumWidth);
+			}
+
+			return sum;
+		}));
+
+		results.push_back(measure("clearance.transform", terrain.name, tiles, options.runs, [&]()
+		{
+			Pathfinder::computeClearance(&passable[0], &clearance[0], terrain.side, terrain.side, 0, terrain.side, MaximumWidth);
+			boost::uint64_t sum = 0;
+			for (size_t i = 0; i < tiles; ++i)
+			{
+				sum += clearance[i];
+			}
+
+			return sum;
+		}));
+
+		Map map;
+		map.setThreads(1);
+		map.setRouteCacheCapacity(0);
+		OriginAndGoal marks;
+		std::string text = terrain.text();
+		if (!map.loadFromText(text.data(), text.size(), marks))
+		{
+			std::cout << "  could not load\n";
+			return;
+		}
+
+		size_t blocks = MapBenchmark::blockCount(map);
+		std::vector<Block> prepared(blocks);
+		std::vector<GraphVertex> edges;
+		results.push_back(measure("createBlockData", terrain.name, blocks, options.runs, [&]()
+		{
+			boost::uint64_t hash = 0;
+			for (size_t b = 0; b < blocks; ++b)
+			{
+				edges.clear();
+				MapBenchmark::createBlockData(map, b, prepared[b], edges);
+				hash = mix(hash, prepared[b].portals.size() + edges.size());
+			}
+
+			return hash;
+		}));
+
+		for (size_t b = 0; b < blocks; ++b)
+		{
+			MapBenchmark::prepareBlock(map, b, prepared[b]);
+		}
+
+		results.push_back(measure("innerblockPathfind", terrain.name, blocks, options.runs, [&]()
+		{
+			boost::uint64_t hash = 0;
+			for (size_t b = 0; b < blocks; ++b)
+			{
+				edges.clear();
+				MapBenchmark::innerblockPathfind(map, prepared[b], edges);
+				for (size_t i = 0; i < edges.size(); ++i)
+				{
+					hash = mix(hash, edges[i].length);
+				}
+			}
+
+			return hash;
+		}));
+
+		std::vector<Index> open = openTiles(map);
+		if (open.empty())
+		{
+			return;
+		}
+
+		std::mt19937 random(options.seed);
+		static const size_t Links = 4000;
+		static const size_t Queries = 500;
+		std::vector<Index> starts(Links);
+		for (size_t i = 0; i < Links; ++i)
+		{
+			starts[i] = open[random() % open.size()];
+		}
+
+		results.push_back(measure("linkPositionAndPortals", terrain.name, Links, options.runs, [&]()
+		{
+			boost::uint64_t hash = 0;
+			for (size_t i = 0; i < Links; ++i)
+			{
+				std::vector<PortalLink> links = map.linkPositionAndPortals(starts[i], 1, GROUND);
+				for (size_t l = 0; l < links.size(); ++l)
+				{
+					hash = mix(hash, links[l].length);
+				}
+			}
+
+			return hash;
+		}));
+
+		std::vector<OriginAndGoal> queries(Queries);
+		std::vector<std::vector<PortalLink> > origins(Queries);
+		std::vector<std::vector<PortalLink> > goals(Queries);
+		for (size_t i = 0; i < Queries; ++i)
+		{
+			queries[i].origin = open[random() % open.size()];
+			queries[i].goal = open[random() % open.size()];
+			origins[i] = map.linkPositionAndPortals(queries[i].origin, 1, GROUND);
+			goals[i] = map.linkPositionAndPortals(queries[i].goal, 1, GROUND);
+		}
+
+		results.push_back(measure("portalPathfind", terrain.name, Queries, options.runs, [&]()
+		{
+			boost::uint64_t hash = 0;
+			for (size_t i = 0; i < Queries; ++i)
+			{
+				hash = mix(hash, map.portalPathfind(origins[i], goals[i], 1, GROUND));
+			}
+
+			return hash;
+		}));
+
+		results.push_back(measure("findPath", terrain.name, Queries, options.runs, [&]()
+		{
+			boost::uint64_t hash = 0;
+			for (size_t i = 0; i < Queries; ++i)
+			{
+				hash = mix(hash, map.findPath(queries[i], 1, GROUND));
+			}
+
+			return hash;
+		}));
+	}
+
+	//Pushes, pops and decreases in the proportions of a grid search: new entries score a
+	//little above the last entry popped.
+	template<typename Open>
+	boost::uint64_t openListWorkload(Open& open, size_t operations, unsigned seed)
+	{
+		typedef typename Open::Entry Entry;
+
+		std::mt19937 random(seed);
+		std::vector<size_t> pushed;
+		pushed.reserve(operations);
+
+		boost::uint64_t hash = 0;
+		size_t floor = 0;
+		for (size_t i = 0; i < operations; ++i)
+		{
+			size_t kind = random() % 8;
+			if (kind < 4 || open.empty())
+			{
+				Entry e;
+				e.element = pushed.size();
+				e.hash = pushed.size();
+				e.gscore = 0;
+				e.fscore = floor + random() % 64;
+				pushed.push_back(e.hash);
+				open.push(e);
+			}
+			else if (kind < 6)
+			{
+				Entry e = open.pop();
+				floor = e.fscore;
+				hash = mix(hash, e.fscore);
+			}
+			else
+			{
+				Entry * e = open.find(pushed[random() % pushed.size()]);
+				if (e && e->fscore > floor)
+				{
+					e->fscore -= 1 + random() % (e->fscore - floor);
+					open.decrease(e);
+				}
+			}
+		}
+
+		return hash;
+	}
+
+	void runOpenLists(const Options& options, std::vector<Result>& results)
+	{
+		static const size_t Operations = 200000;
+		std::cout << "open lists\n";
+
+		results.push_back(measure("openList.heap4", "none", Operations, options.runs, [&]()
+		{
+			Pathfinder::detail::IndexedHeap<size_t, size_t, 4> open;
+			return openListWorkload(open, Operations, options.seed);
+		}));
+
+		results.push_back(measure("openList.heap2", "none", Operations, options.runs, [&]()
+		{
+			Pathfinder::detail::IndexedHeap<size_t, size_t, 2> open;
+			return openListWorkload(open, Operations, options.seed);
+		}));
+
+		typedef Pathfinder::DenseWorkspace<size_t, size_t> Workspace;
+		typedef Pathfinder::detail::DenseOpenListFor<Pathfinder::DefaultOpenList, size_t, size_t> Dense;
+		Engine::Memory::StackAllocator allocator((sizeof(Workspace::Node) + sizeof(Workspace::Entry)) * Operations + 1024);
+		results.push_back(measure("openList.dense", "none", Operations, options.runs, [&]()
+		{
+			Workspace workspace(&allocator, Operations);
+			workspace.begin();
+			Dense::type open = Dense::make(workspace);
+			return openListWorkload(open, Operations, options.seed);
+		}));
+
+		//Sorting before every pop is quadratic, so it gets a shorter run.
+		results.push_back(measure("openList.sorted", "none", Operations / 20, options.runs, [&]()
+		{
+			Pathfinder::detail::SortedVector<size_t, size_t> open;
+			return openListWorkload(open, Operations / 20, options.seed);
+		}));
+	}
+
+	void writeJson(std::ostream& out, const Options& options, const std::vector<Result>& results)
+	{
+		out << "{\n  \"side\": " << options.side << ",\n  \"seed\": " << options.seed << ",\n  \"runs\": " << options.runs
+			<< ",\n  \"benchmarks\": [\n";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const Result& r = results[i];
+			out << "    {\"name\": \"" << r.name << "\", \"map\": \"" << r.map << "\", \"operations\": " << r.operations
+				<< ", \"seconds\": " << r.seconds << ", \"nsPerOperation\": " << r.seconds * 1e9 / std::max<size_t>(r.operations, 1)
+				<< ", \"checksum\": \"" << std::hex << r.checksum << std::dec << "\"}" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+
+		out << "  ]\n}\n";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	Options options = { 256, 1, 3, "pathbench.json" };
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string flag = argv[i];
+		std::istringstream value(argv[i + 1]);
+		if (flag == "--side")
+		{
+			value >> options.side;
+		}
+		else if (flag == "--seed")
+		{
+			value >> options.seed;
+		}
+		else if (flag == "--runs")
+		{
+			value >> options.runs;
+		}
+		else if (flag == "--json")
+		{
+			options.json = argv[i + 1];
+		}
+		else
+		{
+			std::cout << "Unknown option " << flag << "\n";
+			return 1;
+		}
+	}
+
+	//Whole blocks, at least one.
+	options.side = std::max<size_t>(options.side / 16, 1) * 16;
+	options.runs = std::max<size_t>(options.runs, 1);
+
+	typedef Terrain (*Generator)(size_t, std::mt19937&);
+	const Generator generators[] = { openField, maze, rooms, randomObstacles };
+
+	std::vector<Result> results;
+	for (size_t g = 0; g < sizeof(generators) / sizeof(generators[0]); ++g)
+	{
+		std::mt19937 random(options.seed);
+		runTerrain(generators[g](options.side, random), options, results);
+	}
+
+	runOpenLists(options, results);
+
+	std::ofstream out(options.json.c_str());
+	if (!out)
+	{
+		std::cout << "Could not write " << options.json << "\n";
+		return 1;
+	}
+
+	writeJson(out, options, results);
+	std::cout << "Wrote " << options.json << "\n";
+}
@@ -0,0 +1,543 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "map.hpp"
+#include "genericastar.h"
+#include "stackalloc.h"
+#include "textmap.h"
+
+//Runs path queries through the hierarchy and through a flat search of the whole grid, which
+//is optimal, and reports speed against path quality bucketed by the optimal length.
+//Usage: scenariobench [--bucket tiles] [--random n] [--seed n] [--size n] files...
+//Files are Moving AI .scen files, Moving AI .map files, or maps in the format of
+//Map::loadFromText; those of the last kind run the query between their S and G markers.
+//--random adds n queries between open tiles of every map, chosen from the seed.
+
+namespace
+{
+	//Half tiles, as Map measures paths.
+	static const size_t StraightCost = 2;
+	static const size_t DiagonalCost = 3;
+
+	static const int offsetX[] = {-1, 0, 1, -1, 1, -1, 0, 1};
+	static const int offsetY[] = {-1, -1, -1, 0, 0, 1, 1, 1};
+
+	struct Options
+	{
+		size_t bucket;
+		size_t random;
+		unsigned seed;
+		size_t size;
+	};
+
+	//Every tile of the map, 8-connected, passable where a unit of the given size fits.
+	//Corners may be cut, as in the searches of the hierarchy.
+	struct FlatPolicy : public Pathfinder::PathfindPolicy<FlatPolicy>
+	{
+		typedef Index Element;
+		typedef size_t Hash;
+
+		FlatPolicy(const Map& map, const OriginAndGoal& query, size_t size, size_t layer)
+			:map(map)
+			,query(query)
+			,size(size)
+			,layer(layer)
+			,expanded(0)
+		{}
+
+		size_t startingCount()
+		{
+			return 1;
+		}
+
+		const Index& startingPoint(size_t)
+		{
+			return query.origin;
+		}
+
+		size_t startingCost(size_t)
+		{
+			return 0;
+		}
+
+		bool finished(const Index& s)
+		{
+			return s == query.goal;
+		}
+
+		Hash hash(const Index& ind)
+		{
+			return ind.x + ind.y * map.columns();
+		}
+
+		size_t hashRange() const
+		{
+			return map.columns() * map.rows();
+		}
+
+		size_t predict(const Index& s)
+		{
+			size_t dx = s.x > query.goal.x ? s.x - query.goal.x : query.goal.x - s.x;
+			size_t dy = s.y > query.goal.y ? s.y - query.goal.y : query.goal.y - s.y;
+			return std::min(dx, dy) * DiagonalCost + (std::max(dx, dy) - std::min(dx, dy)) * StraightCost;
+		}
+
+		size_t neighborCount(const Index&)
+		{
+			++expanded;
+			return 8;
+		}
+
+		Index neighbor(const Index& elem, size_t i)
+		{
+			return Index(elem.x + offsetX[i], elem.y + offsetY[i]);
+		}
+
+		size_t cost(const Index&, size_t i)
+		{
+			return (offsetX[i] != 0 && offsetY[i] != 0) ? DiagonalCost : StraightCost;
+		}
+
+		//Steps off the map wrap around to coordinates past its size, where passable is 0.
+		bool passable(const Index& elem)
+		{
+			return map.passable(elem, layer) >= size;
+		}
+
+		const Map& map;
+		OriginAndGoal query;
+		size_t size;
+		size_t layer;
+		size_t expanded;
+	};
+
+	struct Scenario
+	{
+		OriginAndGoal query;
+	};
+
+	//Both searches of one scenario.
+	struct Sample
+	{
+		size_t optimal;
+		size_t found;
+		size_t expanded;
+		Pathfinder::QueryStats stats;
+		double flatMicroseconds;
+		double hierarchyMicroseconds;
+	};
+
+	bool readFile(const std::string& path, std::string& text)
+	{
+		std::ifstream input(path.c_str(), std::ios::binary);
+		if (!input)
+		{
+			return false;
+		}
+
+		std::ostringstream contents;
+		contents << input.rdbuf();
+		text = contents.str();
+		return true;
+	}
+
+	//Moving AI maps start with "type octile", then give the height, width and the tiles
+	//after a "map" line. Their terrain is mapped to ours and padded with walls to whole blocks.
+	bool convertMovingAi(const std::string& text, std::string& converted)
+	{
+		std::istringstream input(text);
+		std::string word;
+		size_t height = 0;
+		size_t width = 0;
+		while (input >> word && word != "map")
+		{
+			if (word == "height")
+			{
+				input >> height;
+			}
+			else if (word == "width")
+			{
+				input >> width;
+			}
+		}
+
+		if (word != "map" || !width || !height)
+		{
+			return false;
+		}
+
+		size_t paddedWidth = (width + 15) / 16 * 16;
+		size_t paddedHeight = (height + 15) / 16 * 16;
+		converted.clear();
+		converted.reserve((paddedWidth + 1) * paddedHeight);
+
+		std::string row;
+		for (size_t y = 0; y < paddedHeight; ++y)
+		{
+			if (y < height && !(input >> row && row.size() == width))
+			{
+				return false;
+			}
+
+			for (size_t x = 0; x < paddedWidth; ++x)
+			{
+				char c = (y < height && x < width) ? row[x] : '@';
+				switch (c)
+				{
+				case '.': case 'G': case 'S':
+					converted += '.';
+					break;
+				case 'W':
+					converted += '~';
+					break;
+				default:
+					converted += '0';
+					break;
+				}
+			}
+
+			converted += '\n';
+		}
+
+		return true;
+	}
+
+	//Loads either kind of map. Maps of our own format add their S to G query to scenarios.
+	bool loadMap(const std::string& path, Map& map, std::vector<Scenario>& scenarios)
+	{
+		std::string text;
+		if (!readFile(path, text))
+		{
+			std::cout << "Could not read " << path << "\n";
+			return false;
+		}
+
+		OriginAndGoal markers;
+		Pathfinder::TextMapError error;
+		if (text.compare(0, 4, "type") == 0)
+		{
+			std::string converted;
+			if (!convertMovingAi(text, converted) || !map.loadFromText(converted.data(), converted.size(), markers, &error))
+			{
+				std::cout << "Malformed Moving AI map " << path << "\n";
+				return false;
+			}
+
+			return true;
+		}
+
+		if (!map.loadFromText(text.data(), text.size(), markers, &error))
+		{
+			std::cout << "Malformed map " << path << " at line " << error.line << "\n";
+			return false;
+		}
+
+		if (!(markers.origin == markers.goal))
+		{
+			Scenario scenario = { markers };
+			scenarios.push_back(scenario);
+		}
+
+		return true;
+	}
+
+	//Scenario lines give a bucket, the map, its width and height, the start and goal, and an
+	//optimal length measured without corner cutting, which is why the flat search is rerun.
+	bool loadScenarios(const std::string& path, std::string& mapPath, std::vector<Scenario>& scenarios)
+	{
+		std::ifstream input(path.c_str());
+		std::string line;
+		if (!input || !std::getline(input, line) || line.compare(0, 7, "version") != 0)
+		{
+			std::cout << "Malformed scenario file " << path << "\n";
+			return false;
+		}
+
+		while (std::getline(input, line))
+		{
+			std::istringstream fields(line);
+			size_t bucket, width, height, sx, sy, gx, gy;
+			std::string name;
+			if (!(fields >> bucket >> name >> width >> height >> sx >> sy >> gx >> gy))
+			{
+				continue;
+			}
+
+			//Maps are looked for as named, then next to the scenario file.
+			if (mapPath.empty())
+			{
+				std::string directory = path.substr(0, path.find_last_of('/') + 1);
+				std::string base = name.substr(name.find_last_of('/') + 1);
+				mapPath = std::ifstream(name.c_str()) ? name : directory + base;
+			}
+
+			OriginAndGoal query = { Index(sx, sy), Index(gx, gy) };
+			Scenario scenario = { query };
+			scenarios.push_back(scenario);
+		}
+
+		return true;
+	}
+
+	void addRandom(const Map& map, const Options& options, std::vector<Scenario>& scenarios)
+	{
+		size_t layer = Layers::forCapabilities(GROUND);
+		std::vector<Index> open;
+		for (size_t y = 0; y < map.rows(); ++y)
+		{
+			for (size_t x = 0; x < map.columns(); ++x)
+			{
+				if (map.passable(Index(x, y), layer) >= options.size)
+				{
+					open.push_back(Index(x, y));
+				}
+			}
+		}
+
+		if (open.size() < 2)
+		{
+			return;
+		}
+
+		std::mt19937 random(options.seed);
+		std::uniform_int_distribution<size_t> pick(0, open.size() - 1);
+		for (size_t i = 0; i < options.random; ++i)
+		{
+			OriginAndGoal query = { open[pick(random)], open[pick(random)] };
+			Scenario scenario = { query };
+			scenarios.push_back(scenario);
+		}
+	}
+
+	template<typename F>
+	double microseconds(F f)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		f();
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	double percentile(std::vector<double> values, double p)
+	{
+		if (values.empty())
+		{
+			return 0;
+		}
+
+		std::sort(values.begin(), values.end());
+		return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+	}
+
+	//Reports the samples whose optimal length, in tiles, is in [low, high), on a row named label.
+	void report(const std::vector<Sample>& samples, size_t low, size_t high, const std::string& label)
+	{
+		std::vector<double> flat, hierarchy;
+		size_t expanded = 0;
+		size_t hierarchyExpanded = 0;
+		size_t failed = 0;
+		size_t shorter = 0;
+		size_t within = 0;
+		double ratioSum = 0;
+		double worst = 1;
+		for (size_t i = 0; i < samples.size(); ++i)
+		{
+			const Sample& s = samples[i];
+			size_t tiles = s.optimal / StraightCost;
+			if (tiles < low || tiles >= high)
+			{
+				continue;
+			}
+
+			flat.push_back(s.flatMicroseconds);
+			hierarchy.push_back(s.hierarchyMicroseconds);
+			expanded += s.expanded;
+			hierarchyExpanded += s.stats.expanded;
+			if (s.found == Pathfinder::NoPath)
+			{
+				++failed;
+				continue;
+			}
+
+			//Shorter than optimal means a bug in either search.
+			shorter += s.found < s.optimal;
+
+			double ratio = s.optimal ? static_cast<double>(s.found) / s.optimal : 1;
+			ratioSum += ratio;
+			worst = std::max(worst, ratio);
+			within += ratio <= 1.1;
+		}
+
+		if (flat.empty())
+		{
+			return;
+		}
+
+		size_t solved = flat.size() - failed;
+		std::cout << std::setw(10) << label << std::setw(7) << flat.size()
+			<< std::fixed << std::setprecision(1)
+			<< std::setw(9) << percentile(hierarchy, 0.5) << std::setw(9) << percentile(hierarchy, 0.9)
+			<< std::setw(9) << percentile(hierarchy, 0.99) << std::setw(10) << percentile(hierarchy, 1)
+			<< std::setw(9) << percentile(flat, 0.5) << std::setw(10) << percentile(flat, 0.99)
+			<< std::setw(10) << expanded / flat.size() << std::setw(10) << hierarchyExpanded / flat.size()
+			<< std::setprecision(3)
+			<< std::setw(8) << (solved ? ratioSum / solved : 1) << std::setw(8) << worst
+			<< std::setprecision(1) << std::setw(8) << (solved ? 100.0 * within / solved : 100)
+			<< std::setw(6) << failed << std::setw(6) << shorter << "\n";
+	}
+
+	void run(const std::string& name, const Map& map, const std::vector<Scenario>& scenarios, const Options& options)
+	{
+		size_t layer = Layers::forCapabilities(GROUND);
+		size_t range = map.columns() * map.rows();
+		typedef Pathfinder::DenseWorkspace<Index, size_t> Workspace;
+		size_t flatBytes = range * (sizeof(Workspace::Node) + sizeof(Workspace::Entry)) + 64;
+		Engine::Memory::StackAllocator allocator(flatBytes);
+		Workspace workspace(&allocator, range);
+
+		std::vector<Sample> samples;
+		size_t unreachable = 0;
+		for (size_t i = 0; i < scenarios.size(); ++i)
+		{
+			const OriginAndGoal& query = scenarios[i].query;
+			if (query.origin.x >= map.columns() || query.origin.y >= map.rows() ||
+				query.goal.x >= map.columns() || query.goal.y >= map.rows())
+			{
+				++unreachable;
+				continue;
+			}
+
+			Sample sample;
+			FlatPolicy policy(map, query, options.size, layer);
+			sample.flatMicroseconds = microseconds([&]()
+			{
+				sample.optimal = Pathfinder::pathfind<Index>(policy, workspace, nullptr);
+			});
+
+			if (sample.optimal == Pathfinder::NoPath)
+			{
+				++unreachable;
+				continue;
+			}
+
+			sample.expanded = policy.expanded;
+			sample.hierarchyMicroseconds = microseconds([&]()
+			{
+				sample.found = map.findPath(query, options.size, GROUND, nullptr, &sample.stats);
+			});
+
+			samples.push_back(sample);
+		}
+
+		size_t longest = 0;
+		for (size_t i = 0; i < samples.size(); ++i)
+		{
+			longest = std::max(longest, samples[i].optimal / StraightCost);
+		}
+
+		std::cout << name << ": " << map.columns() << "x" << map.rows() << ", " << samples.size() << " queries, "
+			<< unreachable << " unreachable or off the map skipped\n"
+			<< "memory: map " << map.memoryUsage() / 1024 << " KiB, hierarchy search "
+			<< RouteSearch::bytesRequired(map) / 1024 << " KiB, flat search " << flatBytes / 1024 << " KiB\n"
+			<< "Latencies in microseconds, ratio is found / optimal. Expansions are averages; those of the\n"
+			<< "hierarchy are only counted when built with ENABLE_QUERY_STATS.\n"
+			<< std::setw(10) << "tiles" << std::setw(7) << "count"
+			<< std::setw(9) << "p50" << std::setw(9) << "p90" << std::setw(9) << "p99" << std::setw(10) << "max"
+			<< std::setw(9) << "flat p50" << std::setw(10) << "flat p99" << std::setw(10) << "flat exp" << std::setw(10) << "hier exp"
+			<< std::setw(8) << "ratio" << std::setw(8) << "worst" << std::setw(8) << "<=10%"
+			<< std::setw(6) << "fail" << std::setw(6) << "short" << "\n";
+
+		for (size_t low = 0; low <= longest; low += options.bucket)
+		{
+			std::ostringstream range;
+			range << low << "-" << low + options.bucket - 1;
+			report(samples, low, low + options.bucket, range.str());
+		}
+
+		report(samples, 0, longest + 1, "all");
+		std::cout << "\n";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	Options options = { 64, 0, 1, 1 };
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string flag = argv[i];
+		if (flag.compare(0, 2, "--") != 0)
+		{
+			files.push_back(flag);
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			std::cout << "Missing value for " << flag << "\n";
+			return 1;
+		}
+
+		std::istringstream value(argv[++i]);
+		if (flag == "--bucket")
+		{
+			value >> options.bucket;
+		}
+		else if (flag == "--random")
+		{
+			value >> options.random;
+		}
+		else if (flag == "--seed")
+		{
+			value >> options.seed;
+		}
+		else if (flag == "--size")
+		{
+			value >> options.size;
+		}
+		else
+		{
+			std::cout << "Unknown option " << flag << "\n";
+			return 1;
+		}
+	}
+
+	if (files.empty())
+	{
+		files.push_back("test.map");
+	}
+
+	options.bucket = std::max<size_t>(options.bucket, 1);
+	options.size = std::max<size_t>(options.size, 1);
+
+	for (size_t f = 0; f < files.size(); ++f)
+	{
+		const std::string& file = files[f];
+		std::vector<Scenario> scenarios;
+		std::string mapPath = file;
+		if (file.size() > 5 && file.compare(file.size() - 5, 5, ".scen") == 0)
+		{
+			mapPath.clear();
+			if (!loadScenarios(file, mapPath, scenarios) || mapPath.empty())
+			{
+				continue;
+			}
+		}
+
+		Map map;
+		if (!loadMap(mapPath, map, scenarios))
+		{
+			continue;
+		}
+
+		addRandom(map, options, scenarios);
+		run(file, map, scenarios, options);
+	}
+}
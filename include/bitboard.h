@@ -0,0 +1,30 @@
+#pragma once
+#include <boost/cstdint.hpp>
+#include <cstddef>
+
+namespace Pathfinder
+{
+	//One bit per tile of a 16 × 16 block: bit x of rows[y] is the tile at column x, row y.
+	struct BlockBoard
+	{
+		static const size_t Side = 16;
+
+		boost::uint16_t rows[Side];
+
+		void clear();
+		void set(size_t x, size_t y);
+		bool test(size_t x, size_t y) const;
+		bool empty() const;
+	};
+
+	//Marks an unreached tile in the output of distanceLayers.
+	static const boost::uint16_t NoDistance = 0xFFFF;
+
+	//Cheapest cost from (x, y) to every tile, or NoDistance, with the given costs for straight
+	//and diagonal steps. Settles all tiles of one cost at once from the sets settled straight and
+	//diagonal costs before, so it is exact and never needs an open list. Stops as soon as every
+	//tile of targets is settled; tiles costing more are left at NoDistance, and so is everything
+	//when the start is closed. distances holds Side * Side values, indexed x + y * Side.
+	void distanceLayers(const BlockBoard& open, size_t x, size_t y, size_t straight, size_t diagonal,
+		const BlockBoard& targets, boost::uint16_t * distances);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <boost/cstdint.hpp>
+#include <cstddef>
+
+namespace Pathfinder
+{
+	//Clearance of a tile is the side of the largest square of passable tiles with the tile in
+	//its top left corner, capped at maximum. Tiles are passable when non-zero, and everything
+	//outside the grid is impassable.
+
+	//Computes rows [begin, end) of out from a width × height grid of tiles, with the recurrence
+	//min(run right, run down, clearance down-right + 1) evaluated from the bottom row up, many
+	//tiles at a time. Reads at most maximum - 1 rows past end, so disjoint row ranges can be
+	//computed in parallel. out must not alias tiles.
+	void computeClearance(const boost::uint8_t * tiles, boost::uint8_t * out, size_t width, size_t height,
+		size_t begin, size_t end, size_t maximum);
+
+	//Clearance of a single tile, by scanning the square around it. The reference computeClearance
+	//is checked against in the benchmarks.
+	size_t scanClearance(const boost::uint8_t * tiles, size_t width, size_t height, size_t index, size_t maximum);
+}
@@ -1,14 +1,47 @@
 #pragma once
 #include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <set>
+#include <map>
+#include <memory>
+#include <functional>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "stackalloc.h"
+#include "querystats.h"
 
 namespace Pathfinder
 {
+	//Returned by pathfind when no path exists, and by Policy::cost for an untraversable edge.
+	static const size_t NoPath = ~size_t(0);
+
+	//Open list backends. A policy picks one with a nested OpenList typedef.
+	//Sorted vector, re-sorted before every pop. Kept around for comparison.
+	struct SortedOpenList {};
+
+	//Indexed d-ary heap with a position map, decrease-key is O(log n).
+	template<size_t Arity>
+	struct HeapOpenList {};
+
+	typedef HeapOpenList<4> DefaultOpenList;
+
+	enum SearchStatus
+	{
+		Searching,
+		Found,
+		Failed
+	};
+
 	namespace detail
 	{
-		template<typename T>
+		template<typename T, typename Hash>
 		struct ElementAndScore
 		{
 			T element;
+			Hash hash;
 			size_t gscore;
 			size_t fscore;
 
@@ -19,99 +52,947 @@ namespace Pathfinder
 
 			bool operator==(const ElementAndScore& other) const
 			{
-				return element == other.element;
+				return hash == other.hash;
+			}
+		};
+
+		template<typename T, typename Hash, typename Allocator = std::allocator<ElementAndScore<T, Hash> > >
+		class SortedVector
+		{
+		public:
+			typedef ElementAndScore<T, Hash> Entry;
+
+			SortedVector()
+				:dirty(false)
+			{}
+
+			explicit SortedVector(const Allocator& allocator)
+				:entries(allocator)
+				,dirty(false)
+			{}
+
+			bool empty() const
+			{
+				return entries.empty();
+			}
+
+			size_t size() const
+			{
+				return entries.size();
+			}
+
+			void clear()
+			{
+				entries.clear();
+				dirty = false;
+			}
+
+			void push(const Entry& e)
+			{
+				entries.push_back(e);
+				dirty = true;
+			}
+
+			Entry pop()
+			{
+				//Sorted descending, so the best element sits at the back.
+				if (dirty)
+				{
+					std::sort(entries.rbegin(), entries.rend());
+					dirty = false;
+				}
+
+				Entry result = entries.back();
+				entries.pop_back();
+				return result;
+			}
+
+			Entry * find(Hash h)
+			{
+				for (size_t i = 0; i < entries.size(); ++i)
+				{
+					if (entries[i].hash == h)
+					{
+						return &entries[i];
+					}
+				}
+
+				return nullptr;
+			}
+
+			//Called after the scores of an entry returned by find were lowered.
+			void decrease(Entry *)
+			{
+				dirty = true;
+			}
+		private:
+			std::vector<Entry, Allocator> entries;
+			bool dirty;
+		};
+
+		//Position map for heaps over arbitrary hashes.
+		template<typename Hash, typename Allocator = std::allocator<std::pair<const Hash, size_t> > >
+		class HashPositions
+		{
+			typedef std::unordered_map<Hash, size_t, std::hash<Hash>, std::equal_to<Hash>, Allocator> Positions;
+		public:
+			static const size_t npos = ~size_t(0);
+
+			HashPositions()
+			{}
+
+			explicit HashPositions(const Allocator& allocator)
+				:position(0, std::hash<Hash>(), std::equal_to<Hash>(), allocator)
+			{}
+
+			size_t get(Hash h) const
+			{
+				typename Positions::const_iterator it = position.find(h);
+				return it == position.end() ? npos : it->second;
+			}
+
+			void set(Hash h, size_t i)
+			{
+				position[h] = i;
+			}
+
+			void erase(Hash h)
+			{
+				position.erase(h);
+			}
+
+			void clear()
+			{
+				position.clear();
+			}
+		private:
+			Positions position;
+		};
+
+		//A vector-like view over a fixed block of memory, never reallocates.
+		template<typename T>
+		class FixedVector
+		{
+		public:
+			FixedVector(T * data, size_t capacity)
+				:data(data)
+				,count(0)
+				,capacity(capacity)
+			{}
+
+			bool empty() const { return count == 0; }
+			size_t size() const { return count; }
+			void clear() { count = 0; }
+
+			T& operator[](size_t i) { return data[i]; }
+			const T& operator[](size_t i) const { return data[i]; }
+			T& front() { return data[0]; }
+			T& back() { return data[count - 1]; }
+
+			void push_back(const T& v)
+			{
+				assert(count < capacity);
+				data[count++] = v;
+			}
+
+			void pop_back()
+			{
+				--count;
+			}
+		private:
+			T * data;
+			size_t count;
+			size_t capacity;
+		};
+
+		template<typename T, typename Hash, size_t Arity,
+			typename Buffer = std::vector<ElementAndScore<T, Hash> >,
+			typename Positions = HashPositions<Hash> >
+		class IndexedHeap
+		{
+		public:
+			typedef ElementAndScore<T, Hash> Entry;
+
+			IndexedHeap()
+			{}
+
+			IndexedHeap(const Buffer& heap, const Positions& position)
+				:heap(heap)
+				,position(position)
+			{}
+
+			bool empty() const
+			{
+				return heap.empty();
+			}
+
+			size_t size() const
+			{
+				return heap.size();
+			}
+
+			void clear()
+			{
+				heap.clear();
+				position.clear();
+			}
+
+			void push(const Entry& e)
+			{
+				heap.push_back(e);
+				position.set(e.hash, heap.size() - 1);
+				siftUp(heap.size() - 1);
+			}
+
+			Entry pop()
+			{
+				Entry result = heap.front();
+				position.erase(result.hash);
+
+				if (heap.size() > 1)
+				{
+					heap.front() = heap.back();
+					heap.pop_back();
+					position.set(heap.front().hash, 0);
+					siftDown(0);
+				}
+				else
+				{
+					heap.pop_back();
+				}
+
+				return result;
+			}
+
+			Entry * find(Hash h)
+			{
+				size_t i = position.get(h);
+				if (i == Positions::npos)
+				{
+					return nullptr;
+				}
+
+				return &heap[i];
+			}
+
+			void decrease(Entry * e)
+			{
+				siftUp(e - &heap.front());
+			}
+		private:
+			void place(size_t i, const Entry& e)
+			{
+				heap[i] = e;
+				position.set(e.hash, i);
+			}
+
+			void siftUp(size_t i)
+			{
+				Entry moving = heap[i];
+				while (i > 0)
+				{
+					size_t parent = (i - 1) / Arity;
+					if (!(moving < heap[parent]))
+					{
+						break;
+					}
+
+					place(i, heap[parent]);
+					i = parent;
+				}
+
+				place(i, moving);
+			}
+
+			void siftDown(size_t i)
+			{
+				Entry moving = heap[i];
+				for (;;)
+				{
+					size_t first = i * Arity + 1;
+					if (first >= heap.size())
+					{
+						break;
+					}
+
+					size_t last = std::min(first + Arity, heap.size());
+					size_t best = first;
+					for (size_t c = first + 1; c < last; ++c)
+					{
+						if (heap[c] < heap[best])
+						{
+							best = c;
+						}
+					}
+
+					if (!(heap[best] < moving))
+					{
+						break;
+					}
+
+					place(i, heap[best]);
+					i = best;
+				}
+
+				place(i, moving);
+			}
+
+			Buffer heap;
+			Positions position;
+		};
+
+		//Open lists over arbitrary hashes, their memory coming from Allocator.
+		template<typename Tag, typename T, typename Hash, typename Allocator = std::allocator<char> >
+		struct OpenListFor;
+
+		template<typename T, typename Hash, typename Allocator>
+		struct OpenListFor<SortedOpenList, T, Hash, Allocator>
+		{
+			typedef typename std::allocator_traits<Allocator>::template rebind_alloc<ElementAndScore<T, Hash> > Entries;
+			typedef SortedVector<T, Hash, Entries> type;
+
+			static type make(const Allocator& allocator)
+			{
+				return type(Entries(allocator));
 			}
 		};
+
+		template<size_t Arity, typename T, typename Hash, typename Allocator>
+		struct OpenListFor<HeapOpenList<Arity>, T, Hash, Allocator>
+		{
+			typedef ElementAndScore<T, Hash> Entry;
+			typedef std::vector<Entry, typename std::allocator_traits<Allocator>::template rebind_alloc<Entry> > Buffer;
+			typedef HashPositions<Hash, typename std::allocator_traits<Allocator>::template rebind_alloc<std::pair<const Hash, size_t> > > Positions;
+			typedef IndexedHeap<T, Hash, Arity, Buffer, Positions> type;
+
+			static type make(const Allocator& allocator)
+			{
+				return type(Buffer(allocator), Positions(allocator));
+			}
+		};
+
+		//Closed set and parent links for arbitrary hashes.
+		template<typename T, typename Hash, typename Allocator = std::allocator<char> >
+		class SparseNodes
+		{
+			struct Link
+			{
+				T element;
+				Hash parent;
+			};
+
+			typedef std::allocator_traits<Allocator> Traits;
+			typedef std::set<Hash, std::less<Hash>, typename Traits::template rebind_alloc<Hash> > Closed;
+			typedef std::map<Hash, Link, std::less<Hash>, typename Traits::template rebind_alloc<std::pair<const Hash, Link> > > Links;
+		public:
+			SparseNodes()
+			{}
+
+			explicit SparseNodes(const Allocator& allocator)
+				:closed(std::less<Hash>(), allocator)
+				,from(std::less<Hash>(), allocator)
+			{}
+
+			bool isClosed(Hash h) const
+			{
+				return closed.find(h) != closed.end();
+			}
+
+			void close(Hash h)
+			{
+				closed.insert(h);
+			}
+
+			void setParent(Hash child, const T& element, Hash parent, size_t)
+			{
+				Link& l = from[child];
+				l.element = element;
+				l.parent = parent;
+			}
+
+			const T& element(Hash h)
+			{
+				return from[h].element;
+			}
+
+			Hash parent(Hash h)
+			{
+				return from[h].parent;
+			}
+		private:
+			Closed closed;
+			Links from;
+		};
 	}
 
-	template<typename T>
-	struct PathfindPolicy
+	//Flat per-hash storage for policies whose hashes are dense in [0, hashRange()).
+	//Carved out of a StackAllocator once and reused between queries; bumping the
+	//generation invalidates the previous query's nodes without touching them.
+	template<typename T, typename Hash>
+	class DenseWorkspace : boost::noncopyable
 	{
+	public:
+		typedef detail::ElementAndScore<T, Hash> Entry;
+
+		static const boost::uint32_t NotOpen = 0xFFFFFFFF;
+		static const boost::uint32_t Closed = 0xFFFFFFFE;
+
+		struct Node
+		{
+			boost::uint32_t generation;
+			boost::uint32_t position;
+			Hash parent;
+			size_t gscore;
+			T element;
+		};
+
+		DenseWorkspace(Engine::Memory::StackAllocator * allocator, size_t range)
+			:allocator(allocator)
+			,mark(allocator->mark())
+			,nodes(allocator->allocate<Node>(range))
+			,heap(allocator->allocate<Entry>(range))
+			,capacity(range)
+			,generation(0)
+		{
+			clearGenerations();
+		}
 
+		~DenseWorkspace()
+		{
+			allocator->release(mark);
+		}
+
+		size_t range() const
+		{
+			return capacity;
+		}
+
+		//Starts a new query.
+		void begin()
+		{
+			if (++generation == 0)
+			{
+				clearGenerations();
+				generation = 1;
+			}
+		}
+
+		Node& node(Hash h)
+		{
+			Node& n = nodes[h];
+			if (n.generation != generation)
+			{
+				n.generation = generation;
+				n.position = NotOpen;
+			}
+
+			return n;
+		}
+
+		Entry * heapBuffer()
+		{
+			return heap;
+		}
+
+		//After a search, the cost of reaching h if it was expanded, or NoPath.
+		//Searches that never finish this way compute single-source distances.
+		size_t settled(Hash h) const
+		{
+			const Node& n = nodes[h];
+			if (n.generation != generation || n.position != Closed)
+			{
+				return NoPath;
+			}
+
+			return n.gscore;
+		}
+	private:
+		void clearGenerations()
+		{
+			for (size_t i = 0; i < capacity; ++i)
+			{
+				nodes[i].generation = 0;
+			}
+		}
+
+		Engine::Memory::StackAllocator * allocator;
+		Engine::Memory::StackAllocator::Mark mark;
+
+		Node * nodes;
+		Entry * heap;
+		size_t capacity;
+		boost::uint32_t generation;
 	};
 
-	template<typename U, typename Policy>
-	size_t pathfind(Policy& info, std::vector<U> * path)
+	namespace detail
 	{
-		typedef typename Policy::Element T;
-		typedef typename Policy::Hash Hash;
+		template<typename Workspace, typename T, typename Hash>
+		class DenseNodes
+		{
+		public:
+			explicit DenseNodes(Workspace& ws)
+				:ws(&ws)
+			{}
 
-		std::vector<detail::ElementAndScore<T>> open;
+			bool isClosed(Hash h) const
+			{
+				return ws->node(h).position == Workspace::Closed;
+			}
 
-		size_t startingPoints = info.startingCount();
-		for (size_t i = 0; i < startingPoints; ++i) {
-			T start = info.startingPoint(i);
+			void close(Hash h)
+			{
+				ws->node(h).position = Workspace::Closed;
+			}
 
-			if (!info.passable(start))
+			void setParent(Hash child, const T& element, Hash parent, size_t gscore)
 			{
-				return 0;
+				typename Workspace::Node& n = ws->node(child);
+				n.parent = parent;
+				n.gscore = gscore;
+				n.element = element;
 			}
 
-			detail::ElementAndScore<T> initial;
-			initial.element = start;
-			initial.gscore = 0;
-			initial.fscore = info.predict(start);
+			const T& element(Hash h)
+			{
+				return ws->node(h).element;
+			}
 
-			open.push_back(initial);
-		}
+			Hash parent(Hash h)
+			{
+				return ws->node(h).parent;
+			}
+		private:
+			Workspace * ws;
+		};
+
+		//Heap positions stored in the workspace nodes, no hashing or allocation.
+		template<typename Workspace, typename Hash>
+		class DensePositions
+		{
+		public:
+			static const size_t npos = ~size_t(0);
+
+			explicit DensePositions(Workspace& ws)
+				:ws(&ws)
+			{}
+
+			size_t get(Hash h) const
+			{
+				boost::uint32_t p = ws->node(h).position;
+				return p >= Workspace::Closed ? npos : p;
+			}
+
+			void set(Hash h, size_t i)
+			{
+				ws->node(h).position = static_cast<boost::uint32_t>(i);
+			}
 
-		std::set<Hash> closed;
-		std::map<Hash, Hash> from;
+			void erase(Hash h)
+			{
+				ws->node(h).position = Workspace::NotOpen;
+			}
 
-		while (!open.empty())
+			void clear()
+			{}
+		private:
+			Workspace * ws;
+		};
+
+		template<typename Tag, typename T, typename Hash>
+		struct DenseOpenListFor;
+
+		template<typename T, typename Hash>
+		struct DenseOpenListFor<SortedOpenList, T, Hash>
 		{
-			detail::ElementAndScore<T> target = open.back();
-			Hash targetHash = info.hash(target.element);
+			typedef SortedVector<T, Hash> type;
 
-			open.pop_back();
+			static type make(DenseWorkspace<T, Hash>&)
+			{
+				return type();
+			}
+		};
 
-			if (info.finished(target.element))
+		template<size_t Arity, typename T, typename Hash>
+		struct DenseOpenListFor<HeapOpenList<Arity>, T, Hash>
+		{
+			typedef DenseWorkspace<T, Hash> Workspace;
+			typedef IndexedHeap<T, Hash, Arity,
+				FixedVector<typename Workspace::Entry>,
+				DensePositions<Workspace, Hash> > type;
+
+			static type make(Workspace& ws)
 			{
-				return 1;
+				return type(FixedVector<typename Workspace::Entry>(ws.heapBuffer(), ws.range()),
+					DensePositions<Workspace, Hash>(ws));
 			}
+		};
 
-			closed.insert(targetHash);
+		//Walks the parent links back from the goal. Starting points are their own parent.
+		template<typename U, typename A, typename Nodes, typename Hash>
+		void reconstruct(Nodes& nodes, Hash goal, std::vector<U, A> * path)
+		{
+			path->clear();
 
-			size_t neighbors = info.neighborCount(target.element);
-			for (size_t i = 0; i < neighbors; ++i)
+			Hash current = goal;
+			for (;;)
 			{
-				detail::ElementAndScore<T> score;
-				score.element = info.neighbor(target.element, i);
+				path->push_back(nodes.element(current));
 
-				Hash h = info.hash(score.element);
-				if (closed.find(h) != closed.end())
+				Hash parent = nodes.parent(current);
+				if (parent == current)
 				{
-					continue;
+					break;
 				}
 
-				if (!info.passable(score.element))
-				{
-					continue;
-				}
+				current = parent;
+			}
+
+			std::reverse(path->begin(), path->end());
+		}
 
-				score.gscore = target.gscore + 1;
-				score.fscore = score.gscore + info.predict(score.element);
+		//The search loop, resumable between expansions.
+		template<typename Policy, typename Nodes, typename Open>
+		class Search
+		{
+		public:
+			typedef typename Policy::Element T;
+			typedef typename Policy::Hash Hash;
+			typedef ElementAndScore<T, Hash> Score;
 
-				auto it = std::find(open.begin(), open.end(), score);
-				if (it == open.end())
-				{
-					from[targetHash] = h;
-					open.push_back(score);
+			Search(Policy& info, Nodes& nodes, Open& open)
+				:info(&info)
+				,nodes(&nodes)
+				,open(&open)
+				,status(Searching)
+				,result(NoPath)
+				,best(NoPath)
+				,bestHash()
+				,bestCost(0)
+			{
+				size_t startingPoints = info.startingCount();
+				for (size_t i = 0; i < startingPoints; ++i) {
+					T start = info.startingPoint(i);
+
+					if (!info.passable(start))
+					{
+						status = Failed;
+						return;
+					}
+
+					Score initial;
+					initial.element = start;
+					initial.hash = info.hash(start);
+					initial.gscore = info.startingCost(i);
+					initial.fscore = initial.gscore + info.predict(start);
+
+					Score * existing = open.find(initial.hash);
+					if (!existing)
+					{
+						nodes.setParent(initial.hash, start, initial.hash, initial.gscore);
+						open.push(initial);
+						PATHFINDER_STAT(++queryStats->generated; queryStats->peakOpen = std::max(queryStats->peakOpen, open.size()));
+					}
+					else if (existing->gscore > initial.gscore)
+					{
+						nodes.setParent(initial.hash, start, initial.hash, initial.gscore);
+						*existing = initial;
+						open.decrease(existing);
+						PATHFINDER_STAT(++queryStats->decreaseKeys);
+					}
 				}
-				else
+			}
+
+			//Expands at most maxExpansions elements.
+			SearchStatus step(size_t maxExpansions)
+			{
+				for (size_t expanded = 0; status == Searching && expanded < maxExpansions; ++expanded)
 				{
-					if (it->fscore > score.fscore)
+					if (open->empty())
+					{
+						status = Failed;
+						break;
+					}
+
+					Score target = open->pop();
+					Hash targetHash = target.hash;
+
+					if (info->finished(target.element))
+					{
+						status = Found;
+						result = target.gscore;
+						goal = targetHash;
+						break;
+					}
+
+					nodes->close(targetHash);
+					PATHFINDER_STAT(++queryStats->expanded;
+						++(Policy::AbstractGraph ? queryStats->abstractExpansions : queryStats->tileExpansions));
+
+					//The expanded element closest to the goal ends the best partial path.
+					size_t remaining = target.fscore - target.gscore;
+					if (remaining < best)
 					{
-						from[targetHash] = h;
-						it->fscore = score.fscore;
-						it->gscore = score.gscore;
+						best = remaining;
+						bestHash = targetHash;
+						bestCost = target.gscore;
+					}
+
+					size_t neighbors = info->neighborCount(target.element);
+					for (size_t i = 0; i < neighbors; ++i)
+					{
+						Score score;
+						score.element = info->neighbor(target.element, i);
+
+						if (!info->passable(score.element))
+						{
+							continue;
+						}
+
+						//Dense hashes are only required to be valid for passable elements.
+						Hash h = info->hash(score.element);
+						if (nodes->isClosed(h))
+						{
+							continue;
+						}
+
+						size_t step = info->cost(target.element, i);
+						if (step == NoPath)
+						{
+							continue;
+						}
+
+						score.hash = h;
+						score.gscore = target.gscore + step;
+						score.fscore = score.gscore + info->predict(score.element);
+
+						Score * it = open->find(h);
+						if (!it)
+						{
+							nodes->setParent(h, score.element, targetHash, score.gscore);
+							open->push(score);
+							PATHFINDER_STAT(++queryStats->generated; queryStats->peakOpen = std::max(queryStats->peakOpen, open->size()));
+						}
+						else
+						{
+							if (it->fscore > score.fscore)
+							{
+								//Elements with equal hashes may still differ, as in the direction of a jump point.
+								nodes->setParent(h, score.element, targetHash, score.gscore);
+								it->element = score.element;
+								it->fscore = score.fscore;
+								it->gscore = score.gscore;
+								open->decrease(it);
+								PATHFINDER_STAT(++queryStats->decreaseKeys);
+							}
+						}
 					}
 				}
+
+				return status;
+			}
+
+			SearchStatus state() const
+			{
+				return status;
 			}
 
-			std::sort(open.begin(), open.end());
+			//Cost of the path once Found, NoPath otherwise.
+			size_t length() const
+			{
+				return result;
+			}
+
+			template<typename U, typename A>
+			void path(std::vector<U, A> * out)
+			{
+				assert(status == Found);
+				reconstruct(*nodes, goal, out);
+			}
+
+			//Path to the expanded element with the lowest estimate left, and its cost.
+			//Empty with cost 0 before the first expansion.
+			template<typename U, typename A>
+			size_t partial(std::vector<U, A> * out)
+			{
+				if (best == NoPath)
+				{
+					out->clear();
+					return 0;
+				}
+
+				reconstruct(*nodes, bestHash, out);
+				return bestCost;
+			}
+		private:
+			Policy * info;
+			Nodes * nodes;
+			Open * open;
+
+			SearchStatus status;
+			size_t result;
+			Hash goal;
+
+			size_t best;
+			Hash bestHash;
+			size_t bestCost;
+		};
+
+		template<typename U, typename A, typename Policy, typename Nodes, typename Open>
+		size_t search(Policy& info, Nodes& nodes, Open& open, std::vector<U, A> * path)
+		{
+			Search<Policy, Nodes, Open> s(info, nodes, open);
+			bool found = s.step(NoPath) == Found;
+			if (path && found)
+			{
+				s.path(path);
+			}
+			else if (path)
+			{
+				path->clear();
+			}
+
+			return s.length();
 		}
+	}
+
+	/*
+		Interface expected from a policy, T being Policy::Element:
+			size_t startingCount();
+			T startingPoint(size_t i);
+			size_t startingCost(size_t i);		Cost already paid to reach starting point i.
+			bool finished(const T&);
+			Hash hash(const T&);
+			size_t predict(const T&);			Admissible estimate of the remaining cost.
+			size_t neighborCount(const T&);
+			T neighbor(const T&, size_t i);
+			size_t cost(const T&, size_t i);	Cost of the edge to neighbor i, or NoPath.
+			bool passable(const T&);
+		A policy searching the abstract graph rather than tiles sets AbstractGraph, which
+		only decides where QueryStats counts its expansions.
+	*/
+	template<typename T>
+	struct PathfindPolicy
+	{
+		typedef DefaultOpenList OpenList;
+		static const bool AbstractGraph = false;
+	};
 
-		return 0;
+	//Returns the cost of the cheapest path, or NoPath. If path is given, it is
+	//cleared and filled with the elements from the starting point to the goal,
+	//so the same buffer can be reused across queries. It is left empty without a path.
+	//The open list, closed set and parent links are carved from the StackAllocator::threadLocal
+	//arena of the calling thread and released together on return, so path must not use it.
+	template<typename U, typename A, typename Policy>
+	size_t pathfind(Policy& info, std::vector<U, A> * path)
+	{
+		typedef typename Policy::Element T;
+		typedef typename Policy::Hash Hash;
+		typedef Engine::Memory::StackAdaptor<char> Arena;
+		typedef detail::OpenListFor<typename Policy::OpenList, T, Hash, Arena> Selector;
+
+		Engine::Memory::StackScope scope(&Engine::Memory::StackAllocator::threadLocal());
+		Arena arena(scope);
+		typename Selector::type open = Selector::make(arena);
+		detail::SparseNodes<T, Hash, Arena> nodes(arena);
+		return detail::search(info, nodes, open, path);
+	}
+
+	//Dense mode. Requires Policy::hashRange(), and performs no heap allocation
+	//once the workspace exists.
+	template<typename U, typename A, typename Policy>
+	size_t pathfind(Policy& info, DenseWorkspace<typename Policy::Element, typename Policy::Hash>& workspace, std::vector<U, A> * path)
+	{
+		typedef typename Policy::Element T;
+		typedef typename Policy::Hash Hash;
+		typedef DenseWorkspace<T, Hash> Workspace;
+		typedef detail::DenseOpenListFor<typename Policy::OpenList, T, Hash> Selector;
+
+		assert(info.hashRange() <= workspace.range());
+		workspace.begin();
+
+		typename Selector::type open = Selector::make(workspace);
+		detail::DenseNodes<Workspace, T, Hash> nodes(workspace);
+		return detail::search(info, nodes, open, path);
 	}
+
+	//The cost alone, for callers naming only the element type as before paths took an allocator.
+	template<typename U, typename Policy>
+	size_t pathfind(Policy& info, std::nullptr_t)
+	{
+		return pathfind(info, static_cast<std::vector<U> *>(nullptr));
+	}
+
+	template<typename U, typename Policy>
+	size_t pathfind(Policy& info, DenseWorkspace<typename Policy::Element, typename Policy::Hash>& workspace, std::nullptr_t)
+	{
+		return pathfind(info, workspace, static_cast<std::vector<U> *>(nullptr));
+	}
+
+	//A dense search advanced a bounded number of expansions at a time. The workspace,
+	//open list and closed set live in a StackScope on the given allocator, which is
+	//released when the search is destroyed. The policy must outlive the search.
+	template<typename Policy>
+	class IncrementalSearch : boost::noncopyable
+	{
+		typedef typename Policy::Element T;
+		typedef typename Policy::Hash Hash;
+		typedef DenseWorkspace<T, Hash> Workspace;
+		typedef detail::DenseOpenListFor<typename Policy::OpenList, T, Hash> Selector;
+		typedef detail::DenseNodes<Workspace, T, Hash> Nodes;
+		typedef typename Selector::type Open;
+	public:
+		//Allocator space needed for a policy with the given hashRange.
+		static size_t bytesRequired(size_t range)
+		{
+			return sizeof(Workspace) + range * (sizeof(typename Workspace::Node) + sizeof(typename Workspace::Entry)) + 128;
+		}
+
+		IncrementalSearch(Policy& info, Engine::Memory::StackAllocator * allocator)
+			:scope(allocator)
+			,workspace(prepare(scope, allocator, info.hashRange()))
+			,nodes(*workspace)
+			,open(Selector::make(*workspace))
+			,search(info, nodes, open)
+		{}
+
+		SearchStatus step(size_t maxExpansions)
+		{
+			return search.step(maxExpansions);
+		}
+
+		SearchStatus state() const
+		{
+			return search.state();
+		}
+
+		size_t length() const
+		{
+			return search.length();
+		}
+
+		template<typename U, typename A>
+		void path(std::vector<U, A> * out)
+		{
+			search.path(out);
+		}
+
+		template<typename U, typename A>
+		size_t partial(std::vector<U, A> * out)
+		{
+			return search.partial(out);
+		}
+	private:
+		static Workspace * prepare(Engine::Memory::StackScope& scope, Engine::Memory::StackAllocator * allocator, size_t range)
+		{
+			Workspace * result = scope.create<Workspace>(allocator, range);
+			result->begin();
+			return result;
+		}
+
+		Engine::Memory::StackScope scope;
+		Workspace * workspace;
+		Nodes nodes;
+		Open open;
+		detail::Search<Policy, Nodes, Open> search;
+	};
 }
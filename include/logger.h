@@ -1,5 +1,11 @@
 #pragma once
-#include <sstream>
+#include <atomic>
+#include <ostream>
+
+//Messages below this priority are compiled out of RAWR_LOG. Defaults to keeping all of them.
+#ifndef LOGGING_PRIORITY
+#define LOGGING_PRIORITY 1
+#endif
 
 namespace Rawr
 {
@@ -12,47 +18,84 @@ namespace Rawr
 
 	namespace Detail
 	{
+		//Formats one message into a fixed per-thread buffer and queues it when destroyed.
+		//Messages are written in order by a background thread; a message longer than the
+		//buffer is cut short. Inactive streams ignore everything.
 		class LoggerStream
 		{
 		public:
-			LoggerStream();
-			LoggerStream(const LoggerStream&&);
+			//0 for an inactive stream.
+			explicit LoggerStream(unsigned priority);
+			LoggerStream(LoggerStream&& other);
 			~LoggerStream();
 
 			template<typename T>
 			const LoggerStream& operator<<(const T& v) const
 			{
-				internalStream << v;
+				if (out)
+				{
+					*out << v;
+				}
+
 				return *this;
 			}
 		private:
-			mutable std::stringstream internalStream;
+			unsigned priority;
+			std::ostream * out;
 		};
 	}
 
 	class Logger
 	{
 	public:
+		constexpr Logger()
+			:minimum(Warning)
+		{}
+
+		//Messages below the given priority are dropped from now on. Debug messages are
+		//dropped until asked for, as preprocessing logs a few per block.
+		void setPriority(Priority lowest);
+
+		inline bool enabled(Priority priority) const
+		{
+			return priority >= LOGGING_PRIORITY && priority >= minimum.load(std::memory_order_relaxed);
+		}
+
+		//Waits until every message queued so far is written.
+		void flush() const;
+
+		//Messages written to without a priority are Debug.
 #ifdef DISABLE_LOGGING
 		template<typename T>
 		const Logger& operator<<(const T&) const { return *this; }
 
-		inline const Logger& operator[](size_t) const { return *this; }
+		inline const Logger& operator[](Priority) const { return *this; }
 #else
 		template<typename T>
 		Detail::LoggerStream operator<<(const T& t) const
 		{
-			Detail::LoggerStream res;
+			Detail::LoggerStream res((*this)[Debug]);
 			res << t;
 			return res;
 		}
 
-		inline Detail::LoggerStream operator[](size_t) const
+		inline Detail::LoggerStream operator[](Priority priority) const
 		{
-			return Detail::LoggerStream();
+			return Detail::LoggerStream(enabled(priority) ? priority : 0);
 		}
 #endif
+	private:
+		std::atomic<unsigned> minimum;
 	};
 
 	extern Logger log;
-}
\ No newline at end of file
+}
+
+//Logs at a priority without evaluating the message when the priority is filtered out, at
+//compile time by LOGGING_PRIORITY or at run time by Logger::setPriority:
+//	RAWR_LOG(Rawr::Warning) << "Block " << index << " has no portals";
+#ifdef DISABLE_LOGGING
+#define RAWR_LOG(priority) if (true) {} else ::Rawr::log
+#else
+#define RAWR_LOG(priority) if (!::Rawr::log.enabled(priority)) {} else ::Rawr::log[priority]
+#endif
@@ -2,7 +2,31 @@
 #include <vector>
 #include <boost/cstdint.hpp>
 #include <boost/static_assert.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <iostream>
+#include <mutex>
+
+#include "workpoolfwd.h"
+#include "stackalloc.h"
+#include "sharedarray.h"
+#include "querystats.h"
+
+namespace Pathfinder
+{
+	struct BlockBoard;
+	struct TextMapError;
+}
+
+class RouteCache;
+class Pager;
+
+namespace Engine
+{
+	namespace Memory
+	{
+		class MappedFile;
+	}
+}
 
 enum Direction
 {
@@ -13,6 +37,53 @@ enum Direction
 	UP, DOWN
 };
 
+//Ways a unit can move. Units with several of them pass a mask.
+enum Capability
+{
+	GROUND = 1 << 0,
+	WATER = 1 << 1,
+	AIR = 1 << 2
+};
+
+//Tiles keep a clearance per movement layer, 3 bits each, in the order of Layer.
+namespace Layers
+{
+	enum Layer
+	{
+		Ground, Water, Air, GroundWater, All,
+		Count,
+		None = Count
+	};
+
+	static const size_t Bits = 3;
+	static const boost::uint16_t FieldMask = (1 << Bits) - 1;
+
+	//The layer serving units with the given capabilities, None for an empty mask.
+	size_t forCapabilities(boost::uint8_t capabilities);
+
+	inline size_t get(boost::uint16_t packed, size_t layer)
+	{
+		return (packed >> (layer * Bits)) & FieldMask;
+	}
+
+	//value in every layer open to tiles that the given capabilities can enter, 0 in the others.
+	boost::uint16_t fill(boost::uint8_t capabilities, size_t value);
+
+	//Bit l is set when layer l is non-zero.
+	boost::uint8_t open(boost::uint16_t packed);
+
+	//Per-layer minimum and maximum.
+	boost::uint16_t narrowest(boost::uint16_t a, boost::uint16_t b);
+	boost::uint16_t widest(boost::uint16_t a, boost::uint16_t b);
+}
+
+//How paths inside a block are searched when the tiles walked are wanted.
+enum BlockSearch
+{
+	AStarBlockSearch,
+	JumpPointBlockSearch
+};
+
 //Represents a 4 dimensional uint vector. Generally used to refer to positions in the map.
 //8 bytes.
 struct Index
@@ -39,8 +110,8 @@ std::ostream& operator<<(std::ostream&, const Index&);
 struct Portal
 {
 	Index start;
+	boost::uint16_t passibility;
 	boost::uint8_t direction;
-	boost::uint8_t passibility;
 	boost::uint8_t size;
 
 	bool operator==(const Portal& other) const;
@@ -55,12 +126,124 @@ struct GraphVertex
 	Portal end;
 
 	size_t length;
+	//Largest unit size that can travel this path, per layer.
+	boost::uint16_t clearance;
+};
+
+//An outgoing edge of the abstract graph, in compressed sparse row form.
+struct AbstractEdge
+{
+	boost::uint32_t target;
+	boost::uint32_t length;
+	boost::uint16_t clearance;
+
+	//Zero. Edges are saved byte for byte, so what would be padding is spelled out.
+	boost::uint16_t unused;
+};
+
+BOOST_STATIC_ASSERT(sizeof(AbstractEdge) == 12);
+
+//A portal reachable from some position, and the length of the path to it.
+struct PortalLink
+{
+	Portal portal;
+	size_t length;
+};
+
+//One level of the abstraction hierarchy. Level 0 links the portals of each block,
+//level k links the nodes on the borders of clusters of ClusterBlocks^k blocks.
+//All levels share the node ids of level 0.
+struct AbstractLevel
+{
+	//Side of a cluster, in tiles.
+	size_t clusterSize;
+
+	//The edges leaving node n are edges[offsets[n]] up to edges[offsets[n + 1]].
+	Engine::Memory::SharedArray<boost::uint32_t> offsets;
+	Engine::Memory::SharedArray<AbstractEdge> edges;
+
+	//The nodes present on this level, grouped by cluster.
+	Engine::Memory::SharedArray<boost::uint32_t> clusterOffsets;
+	Engine::Memory::SharedArray<boost::uint32_t> clusterNodes;
 };
 
+struct LevelStats
+{
+	size_t clusterSize;
+	size_t nodes;
+	size_t edges;
+};
+
+//A block while it is being built. Built blocks are stored flat, see BlockRecord.
 struct Block
 {
 	size_t index;
 	std::vector<Portal> portals;
+
+	//Distances from each portal to every tile of the block, for every layer and unit size.
+	//fieldOf[(layer * sizes + size - 1) * portals.size() + p] is the field of portal p, or
+	//NoField. Fields are stored a byte per tile unless some distance needs more. Empty when
+	//the block goes over the table limit, queries then search the block instead.
+	std::vector<boost::uint16_t> fieldOf;
+	std::vector<boost::uint8_t> narrowFields;
+	std::vector<boost::uint16_t> wideFields;
+};
+
+//Where the data of a built block sits in the flat arrays of its map.
+struct BlockRecord
+{
+	//First portal, first entry of the field index, and first distance of the fields.
+	boost::uint64_t portals;
+	boost::uint64_t fieldOf;
+	boost::uint64_t fields;
+
+	boost::uint32_t portalCount;
+	//How the fields are stored, if the block has a table.
+	boost::uint32_t table;
+};
+
+//Memory held by the portal distance tables.
+struct PortalTableStats
+{
+	size_t tabledBlocks;
+	size_t searchedBlocks;
+	size_t bytes;
+};
+
+//A rectangle of tiles, values are given row by row.
+struct TileRegion
+{
+	Index origin;
+	size_t width;
+	size_t height;
+};
+
+//How much preprocessing an update had to redo.
+struct UpdateStats
+{
+	size_t tilesRecomputed;
+	size_t blocksRebuilt;
+	size_t edgesRemoved;
+	size_t edgesAdded;
+	size_t clustersRebuilt;
+};
+
+struct RouteCacheStats
+{
+	size_t hits;
+	size_t misses;
+	size_t entries;
+	size_t invalidated;
+};
+
+//Block data of a mapped map held in memory, see Map::setPageBudget.
+struct PageStats
+{
+	size_t pages;
+	size_t residentPages;
+	size_t residentBytes;
+	size_t loads;
+	size_t evictions;
 };
 
 struct OriginAndGoal
@@ -69,16 +252,23 @@ struct OriginAndGoal
 	Index goal;
 };
 
+//Const members only read the map and keep their search memory per thread, so
+//any number of threads may query a loaded map at once.
 class Map
 {
 	//Private access for the pathfinding policies
 	friend struct PortalPathfindPolicy;
 	friend struct BlockFindPolicy;
+	friend struct JumpPointPolicy;
+	friend class RouteSearch;
+
+	//Times the preprocessing steps block by block, see bench/pathbench.cpp.
+	friend struct MapBenchmark;
 
 	//3 bits.
 	static const size_t MaximumWidth = 7;
 
-	//Bit allocation
+	//Bit allocation, see Layers
 	/*
 		3: Ground passability
 		3: Water passability
@@ -95,33 +285,299 @@ class Map
 	// The {Ground | Air} is simply 'Air' and {Air | Water} is {Ground | Water | Air}
 
 	static const size_t BlockSize = 16;
+
+	//Each level above the first groups this many blocks of the level below in each direction.
+	static const size_t ClusterBlocks = 4;
+
+	//Per block. Most blocks of open maps fit, mazes and blocks with many portals search instead.
+	static const size_t DefaultTableLimit = 32 * 1024;
+
+	//Side of a page of block data, in blocks.
+	static const size_t PageBlocks = 8;
 public:
+	Map();
+	~Map();
+
+	//Number of abstraction levels built by the next load, at least 1.
+	void setLevels(size_t levels);
+
+	//Threads used for preprocessing, 0 for one per hardware thread.
+	//The result is identical for any thread count.
+	void setThreads(size_t threads);
+	size_t threads() const;
+
+	std::vector<LevelStats> levelStats() const;
+
+	//Bytes held by the tiles, block data and abstract graph, whether owned or mapped.
+	size_t memoryUsage() const;
+
+	//Largest portal distance table kept for one block, in bytes, 0 for none. Blocks needing
+	//more link queries to their portals by searching. Applies from the next load.
+	void setPortalTableLimit(size_t bytes);
+	PortalTableStats portalTableStats() const;
+
+	//Routes kept for findPath, 0 to keep none. Queries between the same two blocks, for the
+	//same unit size and layer, reuse the portals of a kept route and only link their ends,
+	//as long as both ends reach it. Reused routes may be longer than a fresh search would
+	//find; updateTiles drops those running through rebuilt blocks.
+	void setRouteCacheCapacity(size_t entries);
+	RouteCacheStats routeCacheStats() const;
+
+	//Jump point search by default. Both give paths of the same cost.
+	void setBlockSearch(BlockSearch method);
+	BlockSearch blockSearch() const;
+
+	//Cheapest path between two tiles of one block. path, if given, receives every tile walked,
+	//and expanded the number of tiles the search expanded. For tools and benchmarks.
+	size_t blockPath(const Index& start, const Index& end, size_t size, boost::uint8_t capabilities,
+		std::vector<Index> * path, size_t * expanded = nullptr) const;
+
+	//Reads a text map, see textmap.h: '0' is a wall, '~' water, '^' only passable by air,
+	//anything else land. 'S' and 'G' mark the origin and goal returned. Malformed text is
+	//logged and leaves the map as it was.
 	OriginAndGoal loadFromStream(std::istream& i);
 
-	size_t walkable(const Index& index, Direction dir) const;
-	size_t passable(const Index& index) const;
+	//The same without copying the text first: loadFromFile parses the mapped file in place.
+	//Return false, leaving the map as it was, when the file cannot be read or the text is
+	//malformed. error, if given, receives the first malformed row.
+	bool loadFromFile(const char * path, OriginAndGoal& result, Pathfinder::TextMapError * error = nullptr);
+	bool loadFromText(const char * text, size_t size, OriginAndGoal& result, Pathfinder::TextMapError * error = nullptr);
+
+	//Writes the preprocessed map in a binary layout that openMapped uses in place. Returns
+	//false if the file cannot be written.
+	bool save(const char * path) const;
+
+	//Uses a file written by save without parsing it: the tiles, blocks, portals, tables and
+	//abstract graph are read straight from its read-only mapping, which every process opening
+	//the file shares. Returns false, leaving the map as it was, when the file is missing,
+	//truncated, of another version or layout, or fails its checksum. Skipping verify saves
+	//reading the whole file up front. updateTiles copies whatever it changes.
+	bool openMapped(const char * path, bool verify = true);
+
+	//Block data of a mapped map, its portals and portal tables, is kept in pages of
+	//PageBlocks × PageBlocks blocks stored together. Once the pages queries used hold more
+	//than the budget, the least recently used ones are dropped from memory, to be read from
+	//the file again when next used. Tiles and the abstract graph stay in memory. 0, the
+	//default, leaves memory to the system. Set between queries.
+	void setPageBudget(size_t bytes);
+	PageStats pageStats() const;
+
+	//Changes terrain after loading. Values are masks of the capabilities that can enter each
+	//tile, 0 being impassable. Only the clearance around the region, the blocks it touches
+	//with their neighbours, and the clusters containing them are rebuilt.
+	UpdateStats updateTiles(const TileRegion& region, const std::vector<boost::uint8_t>& values);
+
+	//Size of the loaded map, in tiles.
+	size_t columns() const;
+	size_t rows() const;
+
+	//Packed clearances of a tile, or of its neighbour in the given direction. 0 outside the map.
+	boost::uint16_t tile(const Index& index) const;
+	boost::uint16_t walkable(const Index& index, Direction dir) const;
+
+	//Clearance of a tile in one layer.
+	size_t passable(const Index& index, size_t layer) const;
 
 	void debugDisplay(const OriginAndGoal& g) const;
-	std::vector<Portal> linkPositionAndPortals(const Index& ind, size_t size) const;
-	size_t portalPathfind(const std::vector<Portal>& origin, const std::vector<Portal>& goals) const;
+
+	//Queries take the capabilities of the unit, one preprocessed map serves all of them.
+	std::vector<PortalLink> linkPositionAndPortals(const Index& ind, size_t size, boost::uint8_t capabilities) const;
+
+	//Cheapest route for a unit of the given size from any origin link to any goal link,
+	//including the link lengths, or Pathfinder::NoPath. path receives the portal tiles visited.
+	//Searches the highest level that separates origin and goal, then refines downwards.
+	size_t portalPathfind(const std::vector<PortalLink>& origins, const std::vector<PortalLink>& goals, size_t size,
+		boost::uint8_t capabilities, std::vector<Index> * path = nullptr) const;
+
+	//Cost of the cheapest route between two tiles, or Pathfinder::NoPath. path, if given,
+	//receives the origin, the portal tiles visited and the goal, and stats the work done.
+	size_t findPath(const OriginAndGoal& query, size_t size, boost::uint8_t capabilities, std::vector<Index> * path = nullptr,
+		Pathfinder::QueryStats * stats = nullptr) const;
+
+	//Answers count queries for units of the given size, spread over the threads of pool.
+	//lengths[i] receives the cost of queries[i]; paths, if given, must hold count routes.
+	void findPaths(Engine::Threading::WorkStealingPool& pool, const OriginAndGoal * queries, size_t count, size_t size,
+		boost::uint8_t capabilities, size_t * lengths, std::vector<Index> * paths = nullptr) const;
+
+	//Work of every query made through findPath, findPaths, portalPathfind, linkPositionAndPortals
+	//and blockPath since construction or resetQueryStats. A query made by another counts as
+	//part of it. Zero unless built with ENABLE_QUERY_STATS, see querystats.h.
+	Pathfinder::QueryStatsTotals queryStats() const;
+	void resetQueryStats();
 private:
 	size_t blockIndex(const Index& ind) const;
 
-	void createBlockData(size_t block);
-	size_t maximumPassibility(size_t index) const;
+	void createBlockData(size_t index, Block& block, std::vector<GraphVertex>& exits) const;
+	void buildBlock(size_t index, Block& block, std::vector<GraphVertex>& exits, std::vector<GraphVertex>& inner) const;
+
+	//Stores built blocks in the flat arrays. Blocks not listed in indices keep their data.
+	void storeBlocks(const std::vector<Block>& built, const std::vector<size_t>& indices);
+	size_t blockCount() const;
+
+	size_t pageOf(size_t block) const;
+
+	//Starts paging the block data of the mapping when there is a budget.
+	void startPaging();
 
 	void preprocess();
-	void createPortalsInBlock(Block& b, const Index& start, const Index& iter, Direction d, size_t iterations);
-	void simplifyBlockPortals(Block& p);
+	void createPortalsInBlock(Block& b, const Index& start, const Index& iter, Direction d, size_t iterations, std::vector<GraphVertex>& exits) const;
+	void simplifyBlockPortals(Block& p) const;
 	void simplifyGraph();
 
-	void innerblockPathfind(const Block& block);
+	void innerblockPathfind(const Block& block, std::vector<GraphVertex>& inner) const;
+
+	static const boost::uint16_t NoField = 0xFFFF;
+	enum TableKind
+	{
+		NoTable,
+		NarrowTable,
+		WideTable
+	};
+
+	void buildPortalTable(Block& block) const;
+
+	//The portals and table of a block, either being built or stored.
+	struct BlockView
+	{
+		size_t index;
+		const Portal * portals;
+		size_t portalCount;
 
-	size_t blockpathfind(size_t blockIndex, const Index& start, const Index& end, size_t size, std::vector<Index> * path) const;
+		//Null without a table. One of the field arrays is null.
+		const boost::uint16_t * fieldOf;
+		const boost::uint8_t * narrowFields;
+		const boost::uint16_t * wideFields;
+	};
 
-	std::vector<boost::uint8_t> map;
-	std::vector<Block> blocks;
-	std::vector<GraphVertex> graph;
+	BlockView viewOf(const Block& block) const;
+	BlockView viewOf(size_t block) const;
 
+	//Distance from portal p of a block to a tile of it for the given layer and size, or
+	//Pathfinder::NoPath. The block must have a table.
+	size_t tableDistance(const BlockView& block, size_t p, const Index& ind, size_t size, size_t layer) const;
+
+	//Distance from a tile to the portal starting at another tile of the same block, or Pathfinder::NoPath.
+	size_t linkDistance(size_t block, const Index& from, const Index& portal, size_t size, size_t layer) const;
+
+	//same[l] is the first layer whose clearance equals that of layer l on every tile of the square.
+	void equalLayers(const Index& origin, size_t side, size_t * same) const;
+	void buildAdjacency(const std::vector<GraphVertex>& vertices);
+	size_t buildLevel(size_t level, Engine::Threading::WorkStealingPool& pool, const AbstractLevel * previous = nullptr,
+		const std::vector<boost::uint32_t> * remap = nullptr, const std::vector<bool> * dirtyBlocks = nullptr);
+	void groupClusters(AbstractLevel& level, const std::vector<bool>& member) const;
+
+	static const boost::uint32_t NoNode = 0xFFFFFFFF;
+	boost::uint32_t nodeId(const Index& ind) const;
+	Index nodeIndex(boost::uint32_t node) const;
+
+	static const size_t NoCluster = ~size_t(0);
+	size_t clusterOf(const Index& ind, size_t level) const;
+	Index blockOrigin(size_t block) const;
+
+	struct NodeLink
+	{
+		boost::uint32_t node;
+		size_t length;
+	};
+
+	//What a query builds comes from the scratch arena of its thread, see arena, and is released
+	//in one step when the query returns.
+	typedef std::vector<NodeLink, Engine::Memory::StackAdaptor<NodeLink> > NodeLinks;
+	typedef std::vector<NodeLinks, Engine::Memory::StackAdaptor<NodeLinks> > LevelLinks;
+	typedef std::vector<boost::uint32_t, Engine::Memory::StackAdaptor<boost::uint32_t> > NodeRoute;
+	typedef std::vector<PortalLink, Engine::Memory::StackAdaptor<PortalLink> > PortalLinks;
+
+	//Appends the links from a position to the portals of its block to result.
+	template<typename Links>
+	void linkPortals(const Index& ind, size_t size, size_t layer, Links& result) const;
+
+	//portalPathfind for links and paths held in any container.
+	template<typename Links, typename Path>
+	size_t routeBetween(const Links& origins, const Links& goals, size_t size, size_t layer, Path * path) const;
+
+	template<typename Links>
+	NodeLinks toNodeLinks(const Links& links) const;
+	bool liftQuery(const Index& from, const Index& to, LevelLinks& starts, LevelLinks& ends, size_t size, size_t layer) const;
+	size_t searchLevel(size_t level, size_t cluster, const NodeLinks& start, const NodeLinks& end,
+		size_t size, size_t layer, NodeRoute * path) const;
+	void settleLevel(size_t level, size_t cluster, const NodeLinks& start, size_t size, size_t layer) const;
+	NodeLinks liftLinks(size_t level, size_t cluster, const NodeLinks& links, size_t size, size_t layer) const;
+	bool refineRoute(size_t level, NodeRoute& route, const NodeLinks& start, const NodeLinks& end,
+		const Index& from, const Index& to, size_t size, size_t layer) const;
+
+	size_t blockpathfind(size_t blockIndex, const Index& start, const Index& end, size_t size, size_t layer,
+		std::vector<Index> * path, size_t * expanded = nullptr) const;
+
+	//Tiles of a block open to units of the given size in one layer.
+	void blockBoard(size_t blockIndex, size_t size, size_t layer, Pathfinder::BlockBoard& board) const;
+
+	//Per-thread search memory, reused by every query made from that thread.
+	struct Scratch;
+	static Scratch& scratch();
+
+	//Allocates from the scratch memory of the calling thread. Public queries open a StackScope
+	//on it first, and everything allocated after goes when they return.
+	static Engine::Memory::StackAdaptor<char> arena();
+
+	//Counts a query made through a public member, see queryStats.
+	class StatsRecorder;
+
+	//Everything a query reads is kept flat, so that it can be borrowed from a mapped file.
+	Engine::Memory::SharedArray<boost::uint16_t> map;
+	Engine::Memory::SharedArray<BlockRecord> blocks;
+	Engine::Memory::SharedArray<Portal> portals;
+	Engine::Memory::SharedArray<boost::uint16_t> fieldOf;
+	Engine::Memory::SharedArray<boost::uint8_t> narrowFields;
+	Engine::Memory::SharedArray<boost::uint16_t> wideFields;
+
+	//Portal tiles get dense node ids in tile order. levels[0] is the adjacency of the
+	//vertices the blocks produce, the levels above it are built from the level below.
+	Engine::Memory::SharedArray<boost::uint32_t> nodeTiles;
+	std::vector<AbstractLevel> levels;
+
+	//The file borrowed from by openMapped, and the pages of it in use.
+	boost::scoped_ptr<Engine::Memory::MappedFile> mapping;
+	boost::scoped_ptr<Pager> pager;
+	size_t pageLimit;
+
+	size_t levelCount;
+	size_t threadCount;
+	size_t tableLimit;
+	BlockSearch searchMethod;
+	boost::scoped_ptr<RouteCache> routes;
 	size_t width;
-};
\ No newline at end of file
+
+	mutable std::mutex statsLock;
+	mutable Pathfinder::QueryStatsTotals statsTotals;
+};
+
+//A query that can be advanced a few expansions at a time, so a unit may start moving
+//before its route is complete. The search state lives on the given allocator until
+//the RouteSearch is destroyed; other queries may run in between steps.
+class RouteSearch : boost::noncopyable
+{
+public:
+	//Allocator space a search on this map needs.
+	static size_t bytesRequired(const Map& map);
+
+	RouteSearch(const Map& map, const OriginAndGoal& query, size_t size, boost::uint8_t capabilities, Engine::Memory::StackAllocator * allocator);
+	~RouteSearch();
+
+	//Expands at most maxExpansions abstract nodes. Returns true once the search is over.
+	bool step(size_t maxExpansions);
+	bool done() const;
+
+	//Cost of the complete route once done, or Pathfinder::NoPath.
+	size_t length() const;
+
+	//The route known so far, and its cost. path receives the tiles walked from the origin
+	//to the first portal, then the portal tiles after it. Until the search is done these end
+	//at the portal closest to the goal, otherwise at the goal. Pathfinder::NoPath, with path
+	//empty, if the route cannot be refined into tiles.
+	size_t route(std::vector<Index> * path) const;
+private:
+	struct State;
+
+	Engine::Memory::StackScope scope;
+	State * state;
+};
@@ -0,0 +1,38 @@
+#pragma once
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace Engine
+{
+	namespace Memory
+	{
+		//A whole file mapped read-only, so processes mapping the same file share its pages.
+		//Where mapping is not available the file is read into memory instead.
+		class MappedFile : boost::noncopyable
+		{
+		public:
+			MappedFile();
+			~MappedFile();
+
+			//Returns false if the file cannot be opened or is empty.
+			bool open(const char * path);
+			void close();
+
+			const boost::uint8_t * data() const;
+			size_t size() const;
+
+			//Hints that a range is about to be read, or drops the whole system pages inside it
+			//from memory. Dropped pages are read from the file again when next used. Both do
+			//nothing where the file is not mapped.
+			void willNeed(size_t offset, size_t length) const;
+			void release(size_t offset, size_t length) const;
+		private:
+			const boost::uint8_t * bytes;
+			size_t length;
+			std::vector<boost::uint8_t> copy;
+		};
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "map.hpp"
+#include "mappedfile.h"
+
+//Bytes of a mapped file belonging to one page.
+struct PageRange
+{
+	size_t offset;
+	size_t length;
+};
+
+//Keeps the pages of a mapped file that queries use within a budget, releasing the least
+//recently used ones. Released pages are read back from the file by their next reader, so
+//nothing changes for threads still reading them: the pager only does the accounting and
+//tells the system which pages to drop. Safe to use from any number of threads.
+class Pager : boost::noncopyable
+{
+public:
+	//ranges[p] are the parts of file making up page p.
+	Pager(const Engine::Memory::MappedFile& file, const std::vector<std::vector<PageRange> >& ranges, size_t budget);
+
+	void setBudget(size_t bytes);
+
+	//Marks a page as used. Costs two relaxed atomic operations while the page is resident.
+	void touch(size_t page)
+	{
+		Page& p = pages[page];
+		p.lastUse.store(clock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		if (!p.resident.load(std::memory_order_acquire))
+		{
+			admit(page);
+		}
+	}
+
+	PageStats stats() const;
+private:
+	struct Page
+	{
+		std::atomic<boost::uint64_t> lastUse;
+		std::atomic<bool> resident;
+		size_t bytes;
+		size_t firstRange;
+		size_t rangeCount;
+	};
+
+	void admit(size_t page);
+
+	//Releases the least recently used pages but keep until the resident bytes are below target.
+	void evictTo(size_t target, size_t keep);
+
+	const Engine::Memory::MappedFile& file;
+	boost::scoped_array<Page> pages;
+	size_t pageCount;
+	std::vector<PageRange> ranges;
+	std::atomic<boost::uint64_t> clock;
+
+	mutable std::mutex lock;
+	size_t limit;
+	size_t residentBytes;
+	size_t residentPages;
+	size_t loads;
+	size_t evictions;
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+
+namespace Pathfinder
+{
+	//Work done by one query. Counted only when built with ENABLE_QUERY_STATS, otherwise the
+	//counting compiles to nothing and stats stay zero.
+	struct QueryStats
+	{
+		//Over every search the query ran. peakOpen is the largest open list of any of them.
+		size_t expanded;
+		size_t generated;
+		size_t peakOpen;
+		size_t decreaseKeys;
+
+		//Expansions split between searches of the abstract graph and searches over tiles.
+		size_t abstractExpansions;
+		size_t tileExpansions;
+
+		//Positions linked to the portals of their block, and those of them that had to
+		//search the block for want of a portal table.
+		size_t links;
+		size_t linkSearches;
+
+		//Most bytes in use at once in the scratch memory of the thread answering the query.
+		size_t scratchHighWater;
+	};
+
+	//Counters summed over many queries. The peaks are the largest of any query.
+	struct QueryStatsTotals
+	{
+		size_t queries;
+		QueryStats counters;
+	};
+
+	inline void accumulate(QueryStatsTotals& totals, const QueryStats& query)
+	{
+		QueryStats& sum = totals.counters;
+		++totals.queries;
+		sum.expanded += query.expanded;
+		sum.generated += query.generated;
+		sum.peakOpen = std::max(sum.peakOpen, query.peakOpen);
+		sum.decreaseKeys += query.decreaseKeys;
+		sum.abstractExpansions += query.abstractExpansions;
+		sum.tileExpansions += query.tileExpansions;
+		sum.links += query.links;
+		sum.linkSearches += query.linkSearches;
+		sum.scratchHighWater = std::max(sum.scratchHighWater, query.scratchHighWater);
+	}
+
+#ifdef ENABLE_QUERY_STATS
+	namespace detail
+	{
+		//The stats of the query running on this thread, null between queries.
+		inline QueryStats *& currentStats()
+		{
+			static thread_local QueryStats * stats = nullptr;
+			return stats;
+		}
+	}
+
+	//Runs statement with queryStats pointing at the stats of the running query, if any.
+#define PATHFINDER_STAT(statement) \
+	do { if (::Pathfinder::QueryStats * queryStats = ::Pathfinder::detail::currentStats()) { statement; } } while (0)
+#else
+#define PATHFINDER_STAT(statement) do {} while (0)
+#endif
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <cstddef>
+
+namespace Engine
+{
+	namespace Threading
+	{
+		//A bounded queue any number of threads may push to and pop from without locking,
+		//after Dmitry Vyukov's ring. Each slot carries a sequence number telling whether it
+		//is free for the push or ready for the pop of the current lap around the ring.
+		//Nothing is allocated after construction.
+		template<typename T>
+		class RingBuffer : boost::noncopyable
+		{
+		public:
+			//Capacity is rounded up to a power of two.
+			explicit RingBuffer(size_t capacity)
+				:mask(roundUp(capacity) - 1)
+				,slots(new Slot[mask + 1])
+				,head(0)
+				,tail(0)
+			{
+				for (size_t i = 0; i <= mask; ++i)
+				{
+					slots[i].sequence.store(i, std::memory_order_relaxed);
+				}
+			}
+
+			~RingBuffer()
+			{
+				delete[] slots;
+			}
+
+			size_t capacity() const
+			{
+				return mask + 1;
+			}
+
+			//Calls fill(T&) on a claimed slot. Returns false, without calling it, when full.
+			template<typename F>
+			bool push(F fill)
+			{
+				size_t position = tail.load(std::memory_order_relaxed);
+				for (;;)
+				{
+					Slot& slot = slots[position & mask];
+					size_t sequence = slot.sequence.load(std::memory_order_acquire);
+					if (sequence == position)
+					{
+						if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+						{
+							fill(slot.value);
+							slot.sequence.store(position + 1, std::memory_order_release);
+							return true;
+						}
+					}
+					else if (sequence < position)
+					{
+						return false;
+					}
+					else
+					{
+						position = tail.load(std::memory_order_relaxed);
+					}
+				}
+			}
+
+			//Calls take(T&) on the oldest element. Returns false, without calling it, when empty.
+			template<typename F>
+			bool pop(F take)
+			{
+				size_t position = head.load(std::memory_order_relaxed);
+				for (;;)
+				{
+					Slot& slot = slots[position & mask];
+					size_t sequence = slot.sequence.load(std::memory_order_acquire);
+					if (sequence == position + 1)
+					{
+						if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+						{
+							take(slot.value);
+							slot.sequence.store(position + mask + 1, std::memory_order_release);
+							return true;
+						}
+					}
+					else if (sequence < position + 1)
+					{
+						return false;
+					}
+					else
+					{
+						position = head.load(std::memory_order_relaxed);
+					}
+				}
+			}
+		private:
+			struct Slot
+			{
+				std::atomic<size_t> sequence;
+				T value;
+			};
+
+			static size_t roundUp(size_t n)
+			{
+				size_t result = 1;
+				while (result < n)
+				{
+					result <<= 1;
+				}
+
+				return result;
+			}
+
+			const size_t mask;
+			Slot * const slots;
+
+			//Apart, so producers and consumers do not share a cache line.
+			alignas(64) std::atomic<size_t> head;
+			alignas(64) std::atomic<size_t> tail;
+		};
+	}
+}
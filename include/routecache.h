@@ -0,0 +1,79 @@
+#pragma once
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "map.hpp"
+#include "stackalloc.h"
+
+//Identifies queries that may share an abstract route.
+struct RouteKey
+{
+	size_t originBlock;
+	size_t goalBlock;
+	size_t size;
+	size_t layer;
+
+	bool operator==(const RouteKey& other) const;
+};
+
+//The portal tiles of a route, and its cost from the first portal to the last.
+struct CachedRoute
+{
+	std::vector<Index> portals;
+	size_t length;
+
+	//Blocks the route runs through, sorted.
+	std::vector<size_t> blocks;
+};
+
+//Portals of a cached route copied out for one query, into memory the query releases.
+typedef std::vector<Index, Engine::Memory::StackAdaptor<Index> > RoutePortals;
+
+//Bounded least recently used map of routes, safe to use from any number of threads.
+class RouteCache : boost::noncopyable
+{
+public:
+	//0 entries disables the cache.
+	explicit RouteCache(size_t capacity = 0);
+
+	//Drops the least recently used entries past the new capacity.
+	void setCapacity(size_t entries);
+	size_t capacity() const;
+
+	//Copies the portals and length of the route of key and counts a hit, or counts a miss.
+	bool find(const RouteKey& key, RoutePortals& portals, size_t& length);
+
+	//A found route that did not fit the query after all. Drops it, and turns its hit into a miss.
+	void reject(const RouteKey& key);
+
+	//Replaces any route of key, making it the most recently used.
+	void insert(const RouteKey& key, const CachedRoute& route);
+
+	//Drops the routes running through any block set in dirty.
+	void invalidate(const std::vector<bool>& dirty);
+	void clear();
+
+	RouteCacheStats stats() const;
+private:
+	struct KeyHash
+	{
+		size_t operator()(const RouteKey& key) const;
+	};
+
+	typedef std::list<std::pair<RouteKey, CachedRoute> > Entries;
+	typedef std::unordered_map<RouteKey, Entries::iterator, KeyHash> Lookup;
+
+	mutable std::mutex lock;
+	Entries entries;
+	Lookup index;
+
+	size_t limit;
+	size_t hits;
+	size_t misses;
+	size_t invalidated;
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace Engine
+{
+	namespace Memory
+	{
+		//Elements that are either owned, or borrowed from memory that outlives the array such
+		//as a mapped file. Reads look the same either way. Borrowed elements are never written:
+		//edit() copies them into owned storage first.
+		template<typename T>
+		class SharedArray
+		{
+		public:
+			typedef const T * const_iterator;
+
+			SharedArray()
+				:borrowed(nullptr)
+				,count(0)
+				,lent(false)
+			{}
+
+			void borrow(const T * elements, size_t size)
+			{
+				std::vector<T>().swap(owned);
+				borrowed = elements;
+				count = size;
+				lent = true;
+			}
+
+			bool isBorrowed() const
+			{
+				return lent;
+			}
+
+			//The owned elements, for any change.
+			std::vector<T>& edit()
+			{
+				if (lent)
+				{
+					owned.assign(borrowed, borrowed + count);
+					lent = false;
+				}
+
+				return owned;
+			}
+
+			//Takes the elements of other, which receives the owned ones, if any.
+			void swap(std::vector<T>& other)
+			{
+				lent = false;
+				owned.swap(other);
+			}
+
+			void clear()
+			{
+				lent = false;
+				owned.clear();
+			}
+
+			const T * data() const
+			{
+				return lent ? borrowed : owned.data();
+			}
+
+			size_t size() const
+			{
+				return lent ? count : owned.size();
+			}
+
+			bool empty() const
+			{
+				return size() == 0;
+			}
+
+			const T& operator[](size_t i) const
+			{
+				return data()[i];
+			}
+
+			const T& front() const
+			{
+				return data()[0];
+			}
+
+			const T& back() const
+			{
+				return data()[size() - 1];
+			}
+
+			const_iterator begin() const
+			{
+				return data();
+			}
+
+			const_iterator end() const
+			{
+				return data() + size();
+			}
+		private:
+			std::vector<T> owned;
+			const T * borrowed;
+			size_t count;
+			bool lent;
+		};
+	}
+}
@@ -5,14 +5,26 @@
 #include <boost/type_traits.hpp>
 #include <boost/preprocessor.hpp>
 
+#include <atomic>
 #include <cassert>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #pragma once
 namespace Engine
 {
 	namespace Memory
 	{
+		//What a StackAllocator is using, see StackAllocator::reportedUsage.
+		struct StackUsage
+		{
+			std::thread::id owner;
+			size_t capacity;
+			size_t chunks;
+			size_t highWater;
+		};
+
 		//This creates 16-byte aligned allocations.
 		class StackAllocator : boost::noncopyable
 		{
@@ -20,10 +32,34 @@ namespace Engine
 			struct Incomplete;
 			typedef Incomplete * Mark;
 
+			enum Flags
+			{
+				//Allocations beyond the first chunk throw std::bad_alloc.
+				Fixed = 0,
+
+				//Chains a new chunk, at least twice the size of the last, when one runs out.
+				//Chunks given back by release are kept and reused.
+				Growable = 1 << 0,
+
+				//Backs chunks with huge pages where the system has them, rounding them up to
+				//whole huge pages. Falls back to transparent huge pages, then to malloc.
+				HugePages = 1 << 1,
+
+				//Listed by reportedUsage while it exists.
+				Reported = 1 << 2
+			};
+
 			//Will always allocate a multiple of 16 bytes.
-			explicit StackAllocator(size_t memoryBytes);
+			explicit StackAllocator(size_t memoryBytes, unsigned flags = Fixed);
 			~StackAllocator();
 
+			//A growable allocator per thread, created on first use and kept until the thread
+			//exits, so whatever runs on a thread reuses one warm arena. Reported.
+			static StackAllocator& threadLocal();
+
+			//The usage of every allocator made with Reported that still exists.
+			static std::vector<StackUsage> reportedUsage();
+
 			template<typename T>
 			size_t computeActualAllocationSize(size_t n) const
 			{
@@ -40,14 +76,19 @@ namespace Engine
 			template<typename T>
 			T * allocate(size_t count)
 			{
-				//Make sure we have enough space to allocate.
-				assert(sizeof(T) * count + (current - base) < avaliableSpace);
 				assert(count > 0);
 
+				size_t bytes = computeActualAllocationSize<T>(count);
+				if (bytes > static_cast<size_t>(end - current))
+				{
+					grow(bytes);
+				}
+
 				T * result = reinterpret_cast<T *>(current);
 
 				//The current pointer is always resting at a multiple of 16 bytes.
-				current += computeActualAllocationSize<T>(count);
+				current += bytes;
+				noteUsage();
 				return result;
 			}
 
@@ -63,14 +104,52 @@ namespace Engine
 			Mark mark();
 			void release(Mark b);
 
+			//Space left in the current chunk.
 			size_t remaining() const;
 			const boost::uint8_t * currentAllocation() const;
 			void reset(boost::uint8_t * point);
+
+			//Most bytes allocated at once since construction or resetHighWater, which starts
+			//over from the bytes allocated now. Counts the ends of chunks left unused by an
+			//allocation that moved on to the next chunk.
+			size_t highWater() const;
+			void resetHighWater();
+
+			StackUsage usage() const;
 		private:
+			struct Chunk;
+
+			void grow(size_t bytes);
+			Chunk * createChunk(size_t bytes);
+			static void destroyChunk(Chunk * chunk);
+			void enter(Chunk * chunk);
+
+			void noteUsage()
+			{
+				size_t used = before + (current - base);
+				if (used > highest.load(std::memory_order_relaxed))
+				{
+					highest.store(used, std::memory_order_relaxed);
+				}
+			}
+
+			//The current chunk spans [base, end).
 			boost::uint8_t * base;
 			boost::uint8_t * current;
+			boost::uint8_t * end;
+
+			Chunk * chunk;
+			Chunk * first;
+			unsigned flags;
+
+			//Bytes of the chunks before the current one.
+			size_t before;
 
-			size_t avaliableSpace;
+			//Readable from other threads through reportedUsage.
+			std::atomic<size_t> highest;
+			std::atomic<size_t> capacity;
+			std::atomic<size_t> chunks;
+			std::thread::id owner;
 		};
 
 		//This is an overlay on the stack allocator, which provides things like destructors.
@@ -121,6 +200,11 @@ namespace Engine
 
 			void close();
 
+			StackAllocator * allocator() const
+			{
+				return base;
+			}
+
 //A few local defines to help out
 #define ENABLE_POD(T) typename boost::enable_if<boost::is_pod<T>, T *>::type
 #define DISABLE_POD(T) typename boost::disable_if<boost::is_pod<T>, T *>::type
@@ -217,5 +301,63 @@ namespace Engine
 			StackAllocator::Mark mark;
 			FinalizerEntry * finalizer;
 		};
+
+		//Lets standard containers allocate from a StackAllocator. Their memory is given back
+		//all at once when the StackScope, or the mark, taken before them is released, so they
+		//must be destroyed first; until then deallocating only reclaims the most recent
+		//allocation. Adaptors over the same allocator compare equal.
+		template<typename T>
+		class StackAdaptor
+		{
+			BOOST_STATIC_ASSERT(boost::alignment_of<T>::value <= 16);
+		public:
+			typedef T value_type;
+
+			explicit StackAdaptor(StackAllocator * base)
+				:base(base)
+			{}
+
+			explicit StackAdaptor(StackScope& scope)
+				:base(scope.allocator())
+			{}
+
+			template<typename U>
+			StackAdaptor(const StackAdaptor<U>& other)
+				:base(other.allocator())
+			{}
+
+			T * allocate(size_t count)
+			{
+				return base->allocate<T>(count > 0 ? count : 1);
+			}
+
+			void deallocate(T * pointer, size_t count)
+			{
+				count = count > 0 ? count : 1;
+				if (base->wasMostRecentAllocation(pointer, count))
+				{
+					base->reset(reinterpret_cast<boost::uint8_t *>(pointer));
+				}
+			}
+
+			StackAllocator * allocator() const
+			{
+				return base;
+			}
+
+			template<typename U>
+			bool operator==(const StackAdaptor<U>& other) const
+			{
+				return base == other.allocator();
+			}
+
+			template<typename U>
+			bool operator!=(const StackAdaptor<U>& other) const
+			{
+				return base != other.allocator();
+			}
+		private:
+			StackAllocator * base;
+		};
 	}
 }
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+
+namespace Pathfinder
+{
+	//Text maps hold one character per tile, a line per row. '|' and '-' only decorate: they are
+	//dropped, and lines holding nothing else are skipped. A '\r' ending a line is ignored, and
+	//so is a missing newline after the last row.
+
+	struct TextMapShape
+	{
+		size_t width;
+		size_t height;
+	};
+
+	//Why a text map was rejected. line counts from 1 and is 0 when the text holds no rows.
+	struct TextMapError
+	{
+		size_t line;
+		size_t expected;
+		size_t found;
+	};
+
+	//Measures the rows of text, comparing each against the first. Returns false, filling
+	//error if given, when there are no rows or some row differs in width.
+	bool measureTextMap(const char * text, size_t size, TextMapShape& shape, TextMapError * error = nullptr);
+
+	//Copies the tile characters of text measured as shape to out, which holds width × height of them.
+	void readTextMap(const char * text, size_t size, const TextMapShape& shape, char * out);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <boost/noncopyable.hpp>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Engine
+{
+	namespace Threading
+	{
+		//A fixed set of threads running index ranges. Each thread starts with an even share
+		//of the range and takes indices from its front; a thread that runs dry steals the back
+		//half of the largest remaining share.
+		class WorkStealingPool : boost::noncopyable
+		{
+		public:
+			//0 threads means one per hardware thread. The calling thread counts as one of them.
+			explicit WorkStealingPool(size_t threads = 0);
+			~WorkStealingPool();
+
+			size_t threadCount() const;
+
+			//Runs task(i) for every i in [0, count) and returns once all of them are done.
+			void parallelFor(size_t count, const std::function<void(size_t)>& task);
+		private:
+			struct Share
+			{
+				std::mutex lock;
+				size_t begin;
+				size_t end;
+			};
+
+			void workerLoop(size_t self);
+			void drain(size_t self);
+			bool take(size_t self, size_t& index);
+			bool steal(size_t self);
+
+			std::vector<std::thread> workers;
+			std::vector<Share> shares;
+
+			std::mutex lock;
+			std::condition_variable wake;
+			std::condition_variable done;
+
+			const std::function<void(size_t)> * task;
+			size_t generation;
+			size_t running;
+			bool stopping;
+		};
+	}
+}
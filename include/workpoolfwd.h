@@ -0,0 +1,9 @@
+#pragma once
+
+namespace Engine
+{
+	namespace Threading
+	{
+		class WorkStealingPool;
+	}
+}
@@ -0,0 +1,143 @@
+#include "bitboard.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace Pathfinder
+{
+	namespace
+	{
+		typedef boost::uint16_t Row;
+
+		//Frontiers keep an empty row above and below the board, so row y of the board is
+		//rows[y + 1] and both of its vertical neighbours always exist.
+		struct Frontier
+		{
+			Row rows[BlockBoard::Side + 2];
+
+			void clear()
+			{
+				std::fill(rows, rows + BlockBoard::Side + 2, Row(0));
+			}
+		};
+
+		//Tiles left and right of the set ones. Bits shifted past either edge fall off.
+		inline Row sideways(Row r)
+		{
+			return static_cast<Row>((r << 1) | (r >> 1));
+		}
+
+		//Enough frontiers to look back one step of any cost below it.
+		static const size_t Ring = 8;
+	}
+
+	void BlockBoard::clear()
+	{
+		std::fill(rows, rows + Side, Row(0));
+	}
+
+	void BlockBoard::set(size_t x, size_t y)
+	{
+		rows[y] |= Row(1) << x;
+	}
+
+	bool BlockBoard::test(size_t x, size_t y) const
+	{
+		return (rows[y] >> x) & 1;
+	}
+
+	bool BlockBoard::empty() const
+	{
+		Row any = 0;
+		for (size_t y = 0; y < Side; ++y)
+		{
+			any |= rows[y];
+		}
+
+		return any == 0;
+	}
+
+	void distanceLayers(const BlockBoard& open, size_t x, size_t y, size_t straight, size_t diagonal,
+		const BlockBoard& targets, boost::uint16_t * distances)
+	{
+		assert(x < BlockBoard::Side && y < BlockBoard::Side);
+		assert(straight > 0 && diagonal > 0 && straight < Ring && diagonal < Ring);
+
+		std::fill(distances, distances + BlockBoard::Side * BlockBoard::Side, NoDistance);
+		if (!open.test(x, y))
+		{
+			return;
+		}
+
+		distances[x + y * BlockBoard::Side] = 0;
+
+		BlockBoard reached;
+		reached.clear();
+		reached.set(x, y);
+
+		BlockBoard remaining = targets;
+		remaining.rows[y] &= ~reached.rows[y];
+		bool targeted = !targets.empty();
+		if (targeted && remaining.empty())
+		{
+			return;
+		}
+
+		//frontier[d % Ring] holds the tiles costing exactly d.
+		Frontier frontier[Ring];
+		for (size_t i = 0; i < Ring; ++i)
+		{
+			frontier[i].clear();
+		}
+
+		frontier[0].rows[y + 1] = reached.rows[y];
+
+		//A cost level only depends on the levels one step before it, so once that many
+		//levels in a row come out empty nothing else can be reached.
+		size_t longest = std::max(straight, diagonal);
+		size_t empty = 0;
+		for (size_t d = 1; empty < longest; ++d)
+		{
+			const Row * fromStraight = frontier[(d + Ring - straight) % Ring].rows;
+			const Row * fromDiagonal = frontier[(d + Ring - diagonal) % Ring].rows;
+			Row * to = frontier[d % Ring].rows;
+
+			Row grown = 0;
+			for (size_t r = 0; r < BlockBoard::Side; ++r)
+			{
+				Row next = sideways(fromStraight[r + 1]) | fromStraight[r] | fromStraight[r + 2];
+				next |= sideways(fromDiagonal[r] | fromDiagonal[r + 2]);
+				next &= open.rows[r] & ~reached.rows[r];
+
+				to[r + 1] = next;
+				reached.rows[r] |= next;
+				grown |= next;
+			}
+
+			if (!grown)
+			{
+				++empty;
+				continue;
+			}
+
+			empty = 0;
+			for (size_t r = 0; r < BlockBoard::Side; ++r)
+			{
+				Row bits = to[r + 1];
+				remaining.rows[r] &= ~bits;
+				for (size_t c = 0; bits; ++c, bits >>= 1)
+				{
+					if (bits & 1)
+					{
+						distances[c + r * BlockBoard::Side] = static_cast<boost::uint16_t>(d);
+					}
+				}
+			}
+
+			if (targeted && remaining.empty())
+			{
+				return;
+			}
+		}
+	}
+}
@@ -0,0 +1,192 @@
+#include "clearance.h"
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Pathfinder
+{
+	namespace
+	{
+#if defined(__AVX2__)
+		typedef __m256i Lanes;
+		static const size_t LaneCount = 32;
+
+		inline Lanes load(const boost::uint8_t * p) { return _mm256_loadu_si256(reinterpret_cast<const Lanes *>(p)); }
+		inline void store(boost::uint8_t * p, Lanes v) { _mm256_storeu_si256(reinterpret_cast<Lanes *>(p), v); }
+		inline Lanes splat(boost::uint8_t v) { return _mm256_set1_epi8(static_cast<char>(v)); }
+		inline Lanes both(Lanes a, Lanes b) { return _mm256_and_si256(a, b); }
+		inline Lanes least(Lanes a, Lanes b) { return _mm256_min_epu8(a, b); }
+		inline Lanes sum(Lanes a, Lanes b) { return _mm256_adds_epu8(a, b); }
+		inline Lanes isZero(Lanes a) { return _mm256_cmpeq_epi8(a, _mm256_setzero_si256()); }
+		inline Lanes butNot(Lanes a, Lanes b) { return _mm256_andnot_si256(a, b); }
+#elif defined(__SSE2__)
+		typedef __m128i Lanes;
+		static const size_t LaneCount = 16;
+
+		inline Lanes load(const boost::uint8_t * p) { return _mm_loadu_si128(reinterpret_cast<const Lanes *>(p)); }
+		inline void store(boost::uint8_t * p, Lanes v) { _mm_storeu_si128(reinterpret_cast<Lanes *>(p), v); }
+		inline Lanes splat(boost::uint8_t v) { return _mm_set1_epi8(static_cast<char>(v)); }
+		inline Lanes both(Lanes a, Lanes b) { return _mm_and_si128(a, b); }
+		inline Lanes least(Lanes a, Lanes b) { return _mm_min_epu8(a, b); }
+		inline Lanes sum(Lanes a, Lanes b) { return _mm_adds_epu8(a, b); }
+		inline Lanes isZero(Lanes a) { return _mm_cmpeq_epi8(a, _mm_setzero_si128()); }
+		inline Lanes butNot(Lanes a, Lanes b) { return _mm_andnot_si128(a, b); }
+#else
+		static const size_t LaneCount = 1;
+#endif
+
+		//0xFF for passable tiles, 0 otherwise. The padding past width stays 0.
+		void passMask(const boost::uint8_t * row, boost::uint8_t * mask, size_t width)
+		{
+			size_t x = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+			for (; x + LaneCount <= width; x += LaneCount)
+			{
+				store(mask + x, butNot(isZero(load(row + x)), splat(0xFF)));
+			}
+#endif
+			for (; x < width; ++x)
+			{
+				mask[x] = row[x] ? 0xFF : 0;
+			}
+		}
+
+		//One row of clearance and downward runs, given those of the row below.
+		void clearanceRow(const boost::uint8_t * mask, const boost::uint8_t * belowClearance, const boost::uint8_t * belowRun,
+			boost::uint8_t * clearance, boost::uint8_t * run, size_t width, size_t maximum)
+		{
+#if defined(__AVX2__) || defined(__SSE2__)
+			const Lanes one = splat(1);
+			const Lanes top = splat(static_cast<boost::uint8_t>(maximum));
+
+			//The buffers are padded, so the last partial group reads and writes zeros past width.
+			for (size_t x = 0; x < width; x += LaneCount)
+			{
+				Lanes pass = load(mask + x);
+				Lanes down = both(least(sum(load(belowRun + x), one), top), pass);
+
+				//Adds one for every k < maximum where tiles x to x + k are all passable.
+				Lanes all = pass;
+				Lanes right = both(pass, one);
+				for (size_t k = 1; k < maximum; ++k)
+				{
+					all = both(all, load(mask + x + k));
+					right = sum(right, both(all, one));
+				}
+
+				Lanes diagonal = sum(load(belowClearance + x + 1), one);
+				store(clearance + x, both(least(least(right, down), diagonal), pass));
+				store(run + x, down);
+			}
+#else
+			for (size_t x = 0; x < width; ++x)
+			{
+				if (!mask[x])
+				{
+					clearance[x] = 0;
+					run[x] = 0;
+					continue;
+				}
+
+				size_t right = 1;
+				while (right < maximum && mask[x + right])
+				{
+					++right;
+				}
+
+				size_t down = std::min<size_t>(belowRun[x] + 1, maximum);
+				size_t diagonal = belowClearance[x + 1] + 1;
+				clearance[x] = static_cast<boost::uint8_t>(std::min(std::min(right, down), diagonal));
+				run[x] = static_cast<boost::uint8_t>(down);
+			}
+#endif
+		}
+	}
+
+	void computeClearance(const boost::uint8_t * tiles, boost::uint8_t * out, size_t width, size_t height,
+		size_t begin, size_t end, size_t maximum)
+	{
+		assert(maximum > 0 && maximum < 255);
+		assert(tiles != out);
+
+		end = std::min(end, height);
+		if (begin >= end)
+		{
+			return;
+		}
+
+		//Room for a full group of lanes starting at the last tile, plus the run to the right.
+		size_t padded = width + LaneCount + maximum + 1;
+		std::vector<boost::uint8_t> mask(padded, 0);
+		std::vector<boost::uint8_t> clearance[2] = { std::vector<boost::uint8_t>(padded, 0), std::vector<boost::uint8_t>(padded, 0) };
+		std::vector<boost::uint8_t> run[2] = { std::vector<boost::uint8_t>(padded, 0), std::vector<boost::uint8_t>(padded, 0) };
+
+		//Clearance only looks maximum - 1 rows down, so rows below that count as impassable.
+		size_t last = std::min(end + maximum - 1, height);
+		for (size_t y = last; y-- > begin;)
+		{
+			size_t current = y & 1;
+			passMask(tiles + y * width, &mask[0], width);
+			clearanceRow(&mask[0], &clearance[current ^ 1][0], &run[current ^ 1][0],
+				&clearance[current][0], &run[current][0], width, maximum);
+
+			if (y < end)
+			{
+				std::copy(clearance[current].begin(), clearance[current].begin() + width, out + y * width);
+			}
+		}
+	}
+
+	size_t scanClearance(const boost::uint8_t * tiles, size_t width, size_t height, size_t index, size_t maximum)
+	{
+		size_t baseX = index % width;
+		size_t baseY = index / width;
+
+		if (tiles[index] == 0)
+		{
+			return 0;
+		}
+
+		for (size_t i = 1; i < maximum; ++i)
+		{
+			if (baseX + i >= width)
+			{
+				return i;
+			}
+
+			if (baseY + i >= height)
+			{
+				return i;
+			}
+
+			//The furthest corner.
+			if (!tiles[index + i * width + i])
+			{
+				return i;
+			}
+
+			//The edges.
+			for (size_t j = 0; j < i; ++j)
+			{
+				if (!tiles[index + j * width + i])
+				{
+					return i;
+				}
+
+				if (!tiles[index + i * width + j])
+				{
+					return i;
+				}
+			}
+		}
+
+		return maximum;
+	}
+}
@@ -1,22 +1,258 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
 
 #include "logger.h"
+#include "ringbuffer.h"
 
 namespace Rawr
 {
 	Logger log;
 
+	namespace
+	{
+		//A formatted message, 256 bytes.
+		struct Record
+		{
+			unsigned priority;
+			unsigned length;
+			char text[248];
+		};
+
+		//Writes into a fixed buffer, dropping whatever does not fit.
+		class FixedBuffer : public std::streambuf
+		{
+		public:
+			void begin(char * text, size_t capacity)
+			{
+				setp(text, text + capacity);
+			}
+
+			size_t length() const
+			{
+				return pptr() - pbase();
+			}
+		protected:
+			int_type overflow(int_type)
+			{
+				return traits_type::eof();
+			}
+		};
+
+		//The message being formatted on a thread.
+		struct Formatter
+		{
+			Formatter()
+				:stream(&buffer)
+				,initial(nullptr)
+			{
+				initial.copyfmt(stream);
+			}
+
+			//Starts a message with the stream as constructed, so a std::hex or precision set
+			//by the one before does not carry over.
+			void begin()
+			{
+				buffer.begin(record.text, sizeof(record.text));
+				stream.clear();
+				stream.copyfmt(initial);
+			}
+
+			Record record;
+			FixedBuffer buffer;
+			std::ostream stream;
+			std::ios initial;
+		};
+
+		Formatter& formatter()
+		{
+			static thread_local Formatter f;
+			return f;
+		}
+
+		//Drains the queue to std::cerr on its own thread, a batch of messages per write.
+		//Producers finding the queue full yield to the writer until a slot frees up, so no
+		//message is lost.
+		class Writer
+		{
+		public:
+			static const size_t Capacity = 4096;
+
+			Writer()
+				:queue(Capacity)
+				,queued(0)
+				,sleeping(false)
+				,written(0)
+				,stopping(false)
+				,thread(&Writer::run, this)
+			{}
+
+			~Writer()
+			{
+				{
+					std::lock_guard<std::mutex> hold(lock);
+					stopping = true;
+				}
+
+				wake.notify_one();
+				thread.join();
+			}
+
+			void submit(const Record& record)
+			{
+				auto copy = [&](Record& slot)
+				{
+					std::memcpy(&slot, &record, offsetof(Record, text) + record.length);
+				};
+
+				while (!queue.push(copy))
+				{
+					wakeWriter();
+					std::this_thread::yield();
+				}
+
+				queued.fetch_add(1, std::memory_order_release);
+				wakeWriter();
+			}
+
+			void flush()
+			{
+				size_t target = queued.load(std::memory_order_acquire);
+				std::unique_lock<std::mutex> hold(lock);
+				wake.notify_one();
+				drained.wait(hold, [&]() { return written >= target; });
+			}
+		private:
+			void wakeWriter()
+			{
+				if (sleeping.load())
+				{
+					std::lock_guard<std::mutex> hold(lock);
+					wake.notify_one();
+				}
+			}
+
+			void run()
+			{
+				std::string batch;
+				batch.reserve(64 * 1024);
+				for (;;)
+				{
+					batch.clear();
+					size_t count = 0;
+					while (queue.pop([&](const Record& record) { append(batch, record); }))
+					{
+						++count;
+					}
+
+					if (!batch.empty())
+					{
+						std::cerr.write(batch.data(), batch.size());
+						std::cerr.flush();
+					}
+
+					std::unique_lock<std::mutex> hold(lock);
+					written += count;
+					drained.notify_all();
+					if (count)
+					{
+						continue;
+					}
+
+					if (stopping)
+					{
+						return;
+					}
+
+					//Woken by submit, or by the timeout should its notification come too early.
+					sleeping = true;
+					wake.wait_for(hold, std::chrono::milliseconds(50));
+					sleeping = false;
+				}
+			}
+
+			static void append(std::string& batch, const Record& record)
+			{
+				if (record.priority == Warning)
+				{
+					batch += "warning: ";
+				}
+				else if (record.priority == Error)
+				{
+					batch += "error: ";
+				}
+
+				batch.append(record.text, record.length);
+				batch += '\n';
+			}
+
+			Engine::Threading::RingBuffer<Record> queue;
+			std::atomic<size_t> queued;
+			std::atomic<bool> sleeping;
+
+			std::mutex lock;
+			std::condition_variable wake;
+			std::condition_variable drained;
+			size_t written;
+			bool stopping;
+
+			std::thread thread;
+		};
+
+		//Started by the first message, stopped after writing everything queued at exit.
+		Writer& writer()
+		{
+			static Writer w;
+			return w;
+		}
+	}
+
+	void Logger::setPriority(Priority lowest)
+	{
+		minimum.store(lowest, std::memory_order_relaxed);
+	}
+
+	void Logger::flush() const
+	{
+		writer().flush();
+	}
+
 	namespace Detail
 	{
-		LoggerStream::LoggerStream()
-		{}
+		LoggerStream::LoggerStream(unsigned priority)
+			:priority(priority)
+			,out(nullptr)
+		{
+			if (priority)
+			{
+				Formatter& f = formatter();
+				f.begin();
+				out = &f.stream;
+			}
+		}
 
-		LoggerStream::LoggerStream(const LoggerStream&&)
-		{}
+		LoggerStream::LoggerStream(LoggerStream&& other)
+			:priority(other.priority)
+			,out(other.out)
+		{
+			other.out = nullptr;
+		}
 
 		LoggerStream::~LoggerStream()
 		{
-			std::cerr << internalStream.str() << "\n";
+			if (out)
+			{
+				Formatter& f = formatter();
+				f.record.priority = priority;
+				f.record.length = static_cast<unsigned>(f.buffer.length());
+				writer().submit(f.record);
+			}
 		}
 	}
-}
\ No newline at end of file
+}
@@ -1,42 +1,100 @@
-#include <fstream>
 #include <string>
 #include <algorithm>
 #include <vector>
 #include <boost/cstdint.hpp>
 #include <iostream>
 #include <sstream>
+#include <chrono>
+#include <random>
 
 #include "map.hpp"
+#include "genericastar.h"
+#include "workpool.h"
+#include "textmap.h"
 
+//The unit tests bring their own main.
+#ifndef TESTING
 int main(int argc, char *argv[]) {
 	const char * directionName[] = {"", "SW", "S", "SE", "W", "C", "E", "NW", "N", "NW", "U", "D"};
 
-	std::ifstream input("test.map");
-
 	Map map;
-	OriginAndGoal goal = map.loadFromStream(input);
+	OriginAndGoal goal;
+	Pathfinder::TextMapError error;
+	if (!map.loadFromFile("test.map", goal, &error))
+	{
+		std::cout << "Could not load test.map";
+		if (error.line)
+		{
+			std::cout << ": line " << error.line << " has " << error.found << " tiles, expected " << error.expected;
+		}
+
+		std::cout << "\n";
+		return 1;
+	}
+
 	map.debugDisplay(goal);
 
 	std::cout << " Origin == \n";
-	std::vector<Portal> origins = map.linkPositionAndPortals(goal.origin, 1);
+	std::vector<PortalLink> origins = map.linkPositionAndPortals(goal.origin, 1, GROUND);
 	for (size_t i = 0; i < origins.size(); ++i)
 	{
-		std::cout << origins[i] << "\n";
+		std::cout << origins[i].portal << " " << origins[i].length << "\n";
 	}
 
 	std::cout << " Goal == \n";
-	std::vector<Portal> goals = map.linkPositionAndPortals(goal.goal, 1);
+	std::vector<PortalLink> goals = map.linkPositionAndPortals(goal.goal, 1, GROUND);
 	for (size_t i = 0; i < goals.size(); ++i)
 	{
-		std::cout << goals[i] << "\n";
+		std::cout << goals[i].portal << " " << goals[i].length << "\n";
 	}
 
-	if (map.portalPathfind(origins, goals))
+	std::vector<Index> route;
+	size_t length = map.portalPathfind(origins, goals, 1, GROUND, &route);
+	if (length != Pathfinder::NoPath)
 	{
-		std::cout << "Path found!\n";
+		std::cout << "Path found! Length " << length << "\n";
+		for (size_t i = 0; i < route.size(); ++i)
+		{
+			std::cout << route[i] << "\n";
+		}
 	}
 	else
 	{
 		std::cout << "No Path\n";
 	}
+
+	//Throughput of batched queries between random open tiles.
+	std::vector<Index> open;
+	for (boost::uint16_t y = 0; y < map.rows(); ++y)
+	{
+		for (boost::uint16_t x = 0; x < map.columns(); ++x)
+		{
+			if (map.passable(Index(x, y), Layers::Ground))
+			{
+				open.push_back(Index(x, y));
+			}
+		}
+	}
+
+	std::mt19937 random(1);
+	std::vector<OriginAndGoal> queries(open.empty() ? 0 : 10000);
+	for (size_t i = 0; i < queries.size(); ++i)
+	{
+		queries[i].origin = open[random() % open.size()];
+		queries[i].goal = open[random() % open.size()];
+	}
+
+	std::vector<size_t> lengths(queries.size());
+	size_t counts[] = { 1, 0 };
+	for (size_t i = 0; i < 2; ++i)
+	{
+		Engine::Threading::WorkStealingPool pool(counts[i]);
+
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		map.findPaths(pool, queries.data(), queries.size(), 1, GROUND, lengths.data());
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+		std::cout << pool.threadCount() << " threads: " << queries.size() / seconds << " queries per second\n";
+	}
 }
+#endif
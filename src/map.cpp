@@ -2,620 +2,3348 @@
 #include <string>
 #include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <fstream>
 #include <set>
 #include <map>
+#include <sstream>
+#include <boost/scoped_ptr.hpp>
 
 #include "logger.h"
 #include "genericastar.h"
+#include "stackalloc.h"
+#include "workpool.h"
+#include "clearance.h"
+#include "bitboard.h"
+#include "routecache.h"
+#include "mappedfile.h"
+#include "textmap.h"
+#include "pager.h"
 
 namespace
 {
-	bool isSeperator(char c)
+	static const int offsetX[] = {0, -1, 0, 1, -1, 0, 1, -1, 0, 1, 0, 0};
+	static const int offsetY[] = {0, 1, 1, 1, 0, 0, 0, -1, -1, -1, 0, 0};
+	static const char * directionName[] = {"", "SW", "S", "SE", "W", "C", "E", "NW", "N", "NW", "U", "D"};
+	static const Direction invert[] = {
+		NONE, NORTHEAST, NORTH, NORTHWEST, EAST, CENTER, WEST, SOUTHEAST, SOUTH, SOUTHWEST, DOWN, UP
+	};
+
+	//Path costs are in half-tiles: moving diagonally costs 1.5 movement.
+	static const size_t StraightCost = 2;
+	static const size_t DiagonalCost = 3;
+
+	size_t stepCost(Direction d)
+	{
+		return (offsetX[d] != 0 && offsetY[d] != 0) ? DiagonalCost : StraightCost;
+	}
+
+	//Octile distance, admissible for the costs above.
+	size_t octile(const Index& a, const Index& b)
+	{
+		size_t dx = a.x > b.x ? a.x - b.x : b.x - a.x;
+		size_t dy = a.y > b.y ? a.y - b.y : b.y - a.y;
+		size_t diagonal = std::min(dx, dy);
+		size_t straight = std::max(dx, dy) - diagonal;
+		return diagonal * DiagonalCost + straight * StraightCost;
+	}
+
+	static const Direction gridNeighbors[8] = {
+		SOUTHWEST, SOUTH, SOUTHEAST, WEST, EAST, NORTHWEST, NORTH, NORTHEAST
+	};
+
+	struct PendingEdge
+	{
+		boost::uint32_t source;
+		AbstractEdge edge;
+
+		bool operator<(const PendingEdge& other) const
+		{
+			if (source != other.source)
+			{
+				return source < other.source;
+			}
+
+			if (edge.target != other.edge.target)
+			{
+				return edge.target < other.edge.target;
+			}
+
+			return edge.length < other.edge.length;
+		}
+	};
+
+	//Sorts edges into compressed sparse row form. Edges between the same nodes with the
+	//same length are merged, keeping the widest clearance of each layer.
+	void flattenEdges(std::vector<PendingEdge>& pending, size_t nodes, AbstractLevel& level)
+	{
+		std::sort(pending.begin(), pending.end());
+
+		std::vector<boost::uint32_t> offsets(nodes + 1, 0);
+		std::vector<AbstractEdge> edges;
+		edges.reserve(pending.size());
+		for (size_t i = 0; i < pending.size(); ++i)
+		{
+			if (i > 0 && pending[i].source == pending[i - 1].source &&
+				pending[i].edge.target == pending[i - 1].edge.target &&
+				pending[i].edge.length == pending[i - 1].edge.length)
+			{
+				edges.back().clearance = Layers::widest(edges.back().clearance, pending[i].edge.clearance);
+				continue;
+			}
+
+			edges.push_back(pending[i].edge);
+			edges.back().unused = 0;
+			++offsets[pending[i].source + 1];
+		}
+
+		for (size_t i = 1; i < offsets.size(); ++i)
+		{
+			offsets[i] += offsets[i - 1];
+		}
+
+		level.offsets.swap(offsets);
+		level.edges.swap(edges);
+	}
+
+	//lengths[l * maximum + s - 1] is the length of a path for units of size s in layer l, or NoPath.
+	//Produces pairs of a length and the widest size per layer that gets a path no longer.
+	void packLengths(const std::vector<size_t>& lengths, size_t maximum, std::vector<std::pair<size_t, boost::uint16_t> >& out)
+	{
+		out.clear();
+
+		//Only the lengths for units of size 1 in each layer are kept, and the longest of all, which
+		//every unit with a path at all fits. Wider units may be charged more than their path
+		//costs, in exchange for a bounded number of edges per pair.
+		std::vector<size_t> distinct;
+		size_t longest = 0;
+		for (size_t i = 0; i < lengths.size(); ++i)
+		{
+			if (lengths[i] != Pathfinder::NoPath)
+			{
+				longest = std::max(longest, lengths[i]);
+				if (i % maximum == 0)
+				{
+					distinct.push_back(lengths[i]);
+				}
+			}
+		}
+
+		if (distinct.empty())
+		{
+			return;
+		}
+
+		distinct.push_back(longest);
+		std::sort(distinct.begin(), distinct.end());
+		distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+		for (size_t i = 0; i < distinct.size(); ++i)
+		{
+			boost::uint16_t clearance = 0;
+			for (size_t l = 0; l < Layers::Count; ++l)
+			{
+				size_t widest = 0;
+				while (widest < maximum && lengths[l * maximum + widest] <= distinct[i])
+				{
+					++widest;
+				}
+
+				clearance |= widest << (l * Layers::Bits);
+			}
+
+			out.push_back(std::make_pair(distinct[i], clearance));
+		}
+	}
+
+	//Length of the shortest link to the portals starting at a tile.
+	template<typename Links>
+	size_t shortestLink(const Links& links, const Index& tile)
+	{
+		size_t shortest = Pathfinder::NoPath;
+		for (size_t i = 0; i < links.size(); ++i)
+		{
+			if (links[i].portal.start == tile)
+			{
+				shortest = std::min(shortest, links[i].length);
+			}
+		}
+
+		return shortest;
+	}
+
+	//The capabilities making up each layer.
+	static const boost::uint8_t layerMembers[Layers::Count] = {
+		GROUND, WATER, AIR, GROUND | WATER, GROUND | WATER | AIR
+	};
+
+	//Layout of a file written by Map::save. The header is followed by the section table,
+	//then by the sections, each starting on a multiple of SectionAlignment. Arrays are
+	//stored as they are in memory, so files only open on machines of the same layout.
+	static const char FileMagic[8] = { 'H', 'P', 'A', 'M', 'A', 'P', 0, 0 };
+	static const boost::uint32_t FileVersion = 2;
+	static const boost::uint32_t EndianMarker = 0x01020304;
+	static const size_t SectionAlignment = 64;
+
+	struct FileHeader
+	{
+		char magic[8];
+		boost::uint32_t version;
+		boost::uint32_t endian;
+
+		//Sizes of the stored structures, which differ between compilers and word sizes.
+		boost::uint32_t indexSize;
+		boost::uint32_t portalSize;
+		boost::uint32_t edgeSize;
+		boost::uint32_t recordSize;
+
+		boost::uint64_t width;
+		boost::uint64_t levels;
+		boost::uint64_t bytes;
+
+		//Of the whole file, taken with this field 0.
+		boost::uint64_t checksum;
+	};
+
+	struct FileSection
+	{
+		boost::uint64_t offset;
+		boost::uint64_t count;
+	};
+
+	//Sections in file order. Each level then adds offsets, edges, clusterOffsets and clusterNodes.
+	enum FileSections
+	{
+		TileSection,
+		BlockSection,
+		PortalSection,
+		FieldOfSection,
+		NarrowFieldSection,
+		WideFieldSection,
+		NodeTileSection,
+		ClusterSizeSection,
+		FixedSections
+	};
+
+	static const size_t LevelSections = 4;
+
+	FileHeader expectedHeader()
+	{
+		FileHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, FileMagic, sizeof(FileMagic));
+		header.version = FileVersion;
+		header.endian = EndianMarker;
+		header.indexSize = sizeof(Index);
+		header.portalSize = sizeof(Portal);
+		header.edgeSize = sizeof(AbstractEdge);
+		header.recordSize = sizeof(BlockRecord);
+		return header;
+	}
+
+	size_t alignSection(size_t offset)
+	{
+		return (offset + SectionAlignment - 1) / SectionAlignment * SectionAlignment;
+	}
+
+	//FNV-1a over 64-bit words, bytes short of a word are held until the next add.
+	class FileChecksum
+	{
+	public:
+		FileChecksum()
+			:hash(14695981039346656037ULL)
+			,held(0)
+		{}
+
+		void add(const void * data, size_t count)
+		{
+			if (count == 0)
+			{
+				//data may be null for an empty section.
+				return;
+			}
+
+			const boost::uint8_t * bytes = static_cast<const boost::uint8_t *>(data);
+			while (count > 0 && held > 0)
+			{
+				tail[held++] = *bytes++;
+				--count;
+				if (held == sizeof(tail))
+				{
+					mix(tail);
+					held = 0;
+				}
+			}
+
+			if (held > 0)
+			{
+				//Everything went to the tail, which is not full yet.
+				return;
+			}
+
+			for (; count >= sizeof(tail); count -= sizeof(tail), bytes += sizeof(tail))
+			{
+				mix(bytes);
+			}
+
+			std::memcpy(tail, bytes, count);
+			held = count;
+		}
+
+		boost::uint64_t value() const
+		{
+			FileChecksum copy(*this);
+			if (copy.held > 0)
+			{
+				std::memset(copy.tail + copy.held, 0, sizeof(tail) - copy.held);
+				copy.mix(copy.tail);
+			}
+
+			return copy.hash;
+		}
+	private:
+		void mix(const boost::uint8_t * word)
+		{
+			boost::uint64_t value;
+			std::memcpy(&value, word, sizeof(value));
+			hash = (hash ^ value) * 1099511628211ULL;
+		}
+
+		boost::uint64_t hash;
+		boost::uint8_t tail[8];
+		size_t held;
+	};
+
+	//Number of fields a block's field index refers to.
+	size_t fieldCount(const boost::uint16_t * fieldOf, size_t entries, boost::uint16_t none)
+	{
+		size_t fields = 0;
+		for (size_t i = 0; i < entries; ++i)
+		{
+			if (fieldOf[i] != none)
+			{
+				fields = std::max<size_t>(fields, fieldOf[i] + 1);
+			}
+		}
+
+		return fields;
+	}
+
+	//Borrows a section into out when it lies inside the file and holds whole elements.
+	template<typename T>
+	bool borrowSection(const Engine::Memory::MappedFile& file, const FileSection& section, Engine::Memory::SharedArray<T>& out)
+	{
+		if (section.offset % SectionAlignment != 0 || section.offset > file.size() ||
+			section.count > (file.size() - section.offset) / sizeof(T))
+		{
+			return false;
+		}
+
+		out.borrow(reinterpret_cast<const T *>(file.data() + section.offset), static_cast<size_t>(section.count));
+		return true;
+	}
+}
+
+namespace Layers
+{
+	//Air can enter every tile ground can, so {Ground, Air} is Air and {Water, Air} is All.
+	size_t forCapabilities(boost::uint8_t capabilities)
+	{
+		capabilities &= GROUND | WATER | AIR;
+		if (!capabilities)
+		{
+			return None;
+		}
+
+		if (capabilities & AIR)
+		{
+			return (capabilities & WATER) ? All : Air;
+		}
+
+		if (capabilities == (GROUND | WATER))
+		{
+			return GroundWater;
+		}
+
+		return capabilities == GROUND ? Ground : Water;
+	}
+
+	boost::uint16_t fill(boost::uint8_t capabilities, size_t value)
+	{
+		boost::uint16_t result = 0;
+		for (size_t l = 0; l < Count; ++l)
+		{
+			if (layerMembers[l] & capabilities)
+			{
+				result |= value << (l * Bits);
+			}
+		}
+
+		return result;
+	}
+
+	boost::uint8_t open(boost::uint16_t packed)
+	{
+		boost::uint8_t result = 0;
+		for (size_t l = 0; l < Count; ++l)
+		{
+			if (get(packed, l))
+			{
+				result |= 1 << l;
+			}
+		}
+
+		return result;
+	}
+
+	boost::uint16_t narrowest(boost::uint16_t a, boost::uint16_t b)
+	{
+		boost::uint16_t result = 0;
+		for (size_t l = 0; l < Count; ++l)
+		{
+			result |= std::min(get(a, l), get(b, l)) << (l * Bits);
+		}
+
+		return result;
+	}
+
+	boost::uint16_t widest(boost::uint16_t a, boost::uint16_t b)
+	{
+		boost::uint16_t result = 0;
+		for (size_t l = 0; l < Count; ++l)
+		{
+			result |= std::max(get(a, l), get(b, l)) << (l * Bits);
+		}
+
+		return result;
+	}
+}
+
+Index::Index()
+{}
+
+//Bound to references by std::min, so they need a definition.
+const size_t Map::BlockSize;
+const boost::uint16_t Map::NoField;
+
+Map::Map()
+	:pageLimit(0)
+	,levelCount(1)
+	,threadCount(0)
+	,tableLimit(DefaultTableLimit)
+	,searchMethod(JumpPointBlockSearch)
+	,routes(new RouteCache())
+	,width(0)
+	,statsTotals()
+{}
+
+Map::~Map()
+{}
+
+Index::Index(boost::uint16_t x, boost::uint16_t y, boost::uint16_t z, boost::uint16_t w)
+	:x(x), y(y), z(z), w(w)
+{}
+
+bool Index::operator==(const Index& i) const
+{
+	return x == i.x && y == i.y && z == i.z && w == i.w;
+}
+
+Index Index::fromIndex(size_t i, size_t w)
+{
+	return Index(i % w, i / w, 0, 0);
+}
+
+size_t Index::index(size_t w) const
+{
+	return x + y * w;
+}
+
+bool Portal::operator==(const Portal& other) const
+{
+	return start == other.start;
+}
+
+std::ostream& operator<<(std::ostream& o, const Index& ind)
+{
+	o << "(" << ind.x << ", " << ind.y << ")";
+	return o;
+}
+
+std::ostream& operator<<(std::ostream& o, const Portal& ind)
+{
+	o << ind.start << " " << directionName[ind.direction] << " " << ind.size;
+	return o;
+}
+
+OriginAndGoal Map::loadFromStream(std::istream& input)
+{
+	std::ostringstream text;
+	text << input.rdbuf();
+
+	const std::string& contents = text.str();
+	OriginAndGoal res;
+	Pathfinder::TextMapError error;
+	if (!loadFromText(contents.data(), contents.size(), res, &error))
+	{
+		RAWR_LOG(Rawr::Error) << "Malformed map: line " << error.line << " has " << error.found << " tiles, expected " << error.expected;
+	}
+
+	return res;
+}
+
+bool Map::loadFromFile(const char * path, OriginAndGoal& result, Pathfinder::TextMapError * error)
+{
+	Engine::Memory::MappedFile file;
+	if (!file.open(path))
+	{
+		if (error)
+		{
+			Pathfinder::TextMapError none = { 0, 0, 0 };
+			*error = none;
+		}
+
+		return false;
+	}
+
+	return loadFromText(reinterpret_cast<const char *>(file.data()), file.size(), result, error);
+}
+
+bool Map::loadFromText(const char * text, size_t size, OriginAndGoal& result, Pathfinder::TextMapError * error)
+{
+	Pathfinder::TextMapShape shape;
+	if (!Pathfinder::measureTextMap(text, size, shape, error))
+	{
+		return false;
+	}
+
+	std::vector<char> characters(shape.width * shape.height);
+	Pathfinder::readTextMap(text, size, shape, &characters[0]);
+
+	boost::uint16_t values[256];
+	for (size_t c = 0; c < 256; ++c)
+	{
+		values[c] = Layers::fill(GROUND | AIR, MaximumWidth);
+	}
+
+	values[static_cast<unsigned char>('0')] = 0;
+	values[static_cast<unsigned char>('~')] = Layers::fill(WATER | AIR, MaximumWidth);
+	values[static_cast<unsigned char>('^')] = Layers::fill(AIR, MaximumWidth);
+
+	std::vector<boost::uint16_t> tiles(characters.size());
+	for (size_t i = 0; i < characters.size(); ++i)
+	{
+		char c = characters[i];
+		tiles[i] = values[static_cast<unsigned char>(c)];
+		if (c == 'G')
+		{
+			result.goal = Index::fromIndex(i, shape.width);
+		}
+		else if (c == 'S')
+		{
+			result.origin = Index::fromIndex(i, shape.width);
+		}
+	}
+
+	width = shape.width;
+	map.swap(tiles);
+	routes->clear();
+	pager.reset();
+	preprocess();
+
+	//Nothing is borrowed from a mapped file any more.
+	mapping.reset();
+	return true;
+}
+
+bool Map::save(const char * path) const
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		return false;
+	}
+
+	std::vector<FileSection> sections(FixedSections + levels.size() * LevelSections);
+	std::vector<boost::uint64_t> clusterSizes(levels.size());
+	for (size_t k = 0; k < levels.size(); ++k)
+	{
+		clusterSizes[k] = levels[k].clusterSize;
+	}
+
+	//Sections are laid out first, so the table can be written ahead of them.
+	std::vector<std::pair<const void *, size_t> > contents(sections.size());
+	size_t offset = alignSection(sizeof(FileHeader) + sections.size() * sizeof(FileSection));
+	auto place = [&](size_t s, const void * data, size_t count, size_t elementSize)
+	{
+		sections[s].offset = offset;
+		sections[s].count = count;
+		contents[s] = std::make_pair(data, count * elementSize);
+		offset = alignSection(offset + count * elementSize);
+	};
+
+	place(TileSection, map.data(), map.size(), sizeof(boost::uint16_t));
+	place(BlockSection, blocks.data(), blocks.size(), sizeof(BlockRecord));
+	place(PortalSection, portals.data(), portals.size(), sizeof(Portal));
+	place(FieldOfSection, fieldOf.data(), fieldOf.size(), sizeof(boost::uint16_t));
+	place(NarrowFieldSection, narrowFields.data(), narrowFields.size(), sizeof(boost::uint8_t));
+	place(WideFieldSection, wideFields.data(), wideFields.size(), sizeof(boost::uint16_t));
+	place(NodeTileSection, nodeTiles.data(), nodeTiles.size(), sizeof(boost::uint32_t));
+	place(ClusterSizeSection, clusterSizes.data(), clusterSizes.size(), sizeof(boost::uint64_t));
+	for (size_t k = 0; k < levels.size(); ++k)
+	{
+		size_t s = FixedSections + k * LevelSections;
+		place(s, levels[k].offsets.data(), levels[k].offsets.size(), sizeof(boost::uint32_t));
+		place(s + 1, levels[k].edges.data(), levels[k].edges.size(), sizeof(AbstractEdge));
+		place(s + 2, levels[k].clusterOffsets.data(), levels[k].clusterOffsets.size(), sizeof(boost::uint32_t));
+		place(s + 3, levels[k].clusterNodes.data(), levels[k].clusterNodes.size(), sizeof(boost::uint32_t));
+	}
+
+	FileHeader header = expectedHeader();
+	header.width = width;
+	header.levels = levels.size();
+	header.bytes = offset;
+
+	//Everything after the header is hashed as it is written, the header last.
+	FileChecksum checksum;
+	static const char padding[SectionAlignment] = {};
+	size_t written = sizeof(FileHeader);
+	auto write = [&](const void * data, size_t count)
+	{
+		out.write(static_cast<const char *>(data), count);
+		checksum.add(data, count);
+		written += count;
+
+		size_t pad = alignSection(written) - written;
+		out.write(padding, pad);
+		checksum.add(padding, pad);
+		written += pad;
+	};
+
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	write(sections.data(), sections.size() * sizeof(FileSection));
+	for (size_t s = 0; s < contents.size(); ++s)
+	{
+		write(contents[s].first, contents[s].second);
+	}
+
+	checksum.add(&header, sizeof(header));
+	header.checksum = checksum.value();
+	out.seekp(0);
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	out.flush();
+	return out.good();
+}
+
+bool Map::openMapped(const char * path, bool verify)
+{
+	boost::scoped_ptr<Engine::Memory::MappedFile> file(new Engine::Memory::MappedFile());
+	if (!file->open(path) || file->size() < sizeof(FileHeader))
+	{
+		return false;
+	}
+
+	FileHeader header;
+	std::memcpy(&header, file->data(), sizeof(header));
+	boost::uint64_t stored = header.checksum;
+	header.checksum = 0;
+
+	//Everything but the layout fields must match a header written on this machine.
+	FileHeader expected = expectedHeader();
+	expected.width = header.width;
+	expected.levels = header.levels;
+	expected.bytes = header.bytes;
+	if (std::memcmp(&header, &expected, sizeof(header)) != 0 || header.bytes != file->size() ||
+		header.width == 0 || header.levels == 0 || header.levels > 64)
+	{
+		return false;
+	}
+
+	size_t sectionCount = FixedSections + static_cast<size_t>(header.levels) * LevelSections;
+	if (file->size() < sizeof(FileHeader) + sectionCount * sizeof(FileSection))
+	{
+		return false;
+	}
+
+	if (verify)
+	{
+		FileChecksum checksum;
+		checksum.add(file->data() + sizeof(FileHeader), file->size() - sizeof(FileHeader));
+		checksum.add(&header, sizeof(header));
+		if (checksum.value() != stored)
+		{
+			return false;
+		}
+
+		//Hashing read every page. Queries read back the ones they use.
+		file->release(0, file->size());
+	}
+
+	std::vector<FileSection> sections(sectionCount);
+	std::memcpy(&sections[0], file->data() + sizeof(FileHeader), sectionCount * sizeof(FileSection));
+
+	Engine::Memory::SharedArray<boost::uint16_t> newMap;
+	Engine::Memory::SharedArray<BlockRecord> newBlocks;
+	Engine::Memory::SharedArray<Portal> newPortals;
+	Engine::Memory::SharedArray<boost::uint16_t> newFieldOf;
+	Engine::Memory::SharedArray<boost::uint8_t> newNarrow;
+	Engine::Memory::SharedArray<boost::uint16_t> newWide;
+	Engine::Memory::SharedArray<boost::uint32_t> newNodeTiles;
+	Engine::Memory::SharedArray<boost::uint64_t> clusterSizes;
+	std::vector<AbstractLevel> newLevels(static_cast<size_t>(header.levels));
+
+	bool valid = borrowSection(*file, sections[TileSection], newMap) &&
+		borrowSection(*file, sections[BlockSection], newBlocks) &&
+		borrowSection(*file, sections[PortalSection], newPortals) &&
+		borrowSection(*file, sections[FieldOfSection], newFieldOf) &&
+		borrowSection(*file, sections[NarrowFieldSection], newNarrow) &&
+		borrowSection(*file, sections[WideFieldSection], newWide) &&
+		borrowSection(*file, sections[NodeTileSection], newNodeTiles) &&
+		borrowSection(*file, sections[ClusterSizeSection], clusterSizes) &&
+		clusterSizes.size() == newLevels.size();
+
+	size_t newWidth = static_cast<size_t>(header.width);
+	valid = valid && newMap.size() % newWidth == 0 &&
+		newBlocks.size() == newMap.size() / (BlockSize * BlockSize);
+
+	for (size_t k = 0; valid && k < newLevels.size(); ++k)
+	{
+		AbstractLevel& level = newLevels[k];
+		size_t s = FixedSections + k * LevelSections;
+		level.clusterSize = static_cast<size_t>(clusterSizes[k]);
+		valid = borrowSection(*file, sections[s], level.offsets) &&
+			borrowSection(*file, sections[s + 1], level.edges) &&
+			borrowSection(*file, sections[s + 2], level.clusterOffsets) &&
+			borrowSection(*file, sections[s + 3], level.clusterNodes) &&
+			level.clusterSize > 0 &&
+			level.offsets.size() == newNodeTiles.size() + 1 && level.offsets.back() == level.edges.size() &&
+			!level.clusterOffsets.empty() && level.clusterOffsets.back() == level.clusterNodes.size();
+	}
+
+	//Queries index the flat arrays through the records without checking them.
+	for (size_t b = 0; valid && b < newBlocks.size(); ++b)
+	{
+		const BlockRecord& record = newBlocks[b];
+		size_t entries = Layers::Count * MaximumWidth * record.portalCount;
+		valid = record.portals + record.portalCount <= newPortals.size() && record.table <= WideTable &&
+			(record.table == NoTable || record.fieldOf + entries <= newFieldOf.size());
+		if (!valid || record.table == NoTable)
+		{
+			continue;
+		}
+
+		size_t fields = fieldCount(newFieldOf.data() + record.fieldOf, entries, NoField);
+		size_t available = record.table == NarrowTable ? newNarrow.size() : newWide.size();
+		valid = record.fields <= available && fields * BlockSize * BlockSize <= available - record.fields;
+	}
+
+	if (!valid)
+	{
+		return false;
+	}
+
+	pager.reset();
+	map = newMap;
+	blocks = newBlocks;
+	portals = newPortals;
+	fieldOf = newFieldOf;
+	narrowFields = newNarrow;
+	wideFields = newWide;
+	nodeTiles = newNodeTiles;
+	levels.swap(newLevels);
+	levelCount = levels.size();
+	width = newWidth;
+	routes->clear();
+
+	//The arrays of a previous mapping, if any, are no longer used.
+	mapping.swap(file);
+	RAWR_LOG(Rawr::Debug) << "Mapped " << path << ": " << mapping->size() << " bytes, " << levels[0].edges.size() << " level 0 edges";
+	startPaging();
+	return true;
+}
+
+boost::uint16_t Map::walkable(const Index& ind, Direction direction) const
+{
+	int x = static_cast<int>(ind.x);
+	int y = static_cast<int>(ind.y);
+	size_t height = map.size() / width;
+
+	x += offsetX[direction];
+	y += offsetY[direction];
+
+	if (x < 0 || y < 0)
+	{
+		return 0;
+	}
+
+	if (x >= width || y >= height)
+	{
+		return 0;
+	}
+
+	return map[Index(x, y).index(width)];
+}
+
+size_t Map::columns() const
+{
+	return width;
+}
+
+size_t Map::rows() const
+{
+	return width ? map.size() / width : 0;
+}
+
+boost::uint16_t Map::tile(const Index& ind) const
+{
+	if (ind.x >= width || ind.x < 0)
+	{
+		return 0;
+	}
+
+	if (ind.y >= map.size() / width || ind.y < 0)
+	{
+		return 0;
+	}
+
+	return map[ind.index(width)];
+}
+
+size_t Map::passable(const Index& ind, size_t layer) const
+{
+	return Layers::get(tile(ind), layer);
+}
+
+size_t Map::blockIndex(const Index& ind) const
+{
+	size_t blockWidth = width / BlockSize;
+	size_t blockX = (ind.x / BlockSize);
+	size_t blockY = (ind.y / BlockSize);
+
+	return blockX + blockY * blockWidth;
+}
+
+void Map::createPortalsInBlock(Block& out, const Index& start, const Index& iterate, Direction d, size_t iterations, std::vector<GraphVertex>& exits) const
+{
+	boost::uint16_t clearances[BlockSize];
+	assert(iterations <= BlockSize);
+
+	for (size_t i = 0; i < iterations; ++i)
+	{
+		Index current = Index(start.x + iterate.x * i, start.y + iterate.y * i);
+		boost::uint16_t pass = Layers::narrowest(tile(current), walkable(current, d));
+		if (!pass)
+		{
+			continue;
+		}
+
+		//A span covers the tiles open to the same layers.
+		boost::uint8_t layers = Layers::open(pass);
+		size_t span = 0;
+		while (i + span < iterations)
+		{
+			Index next = Index(current.x + iterate.x * span, current.y + iterate.y * span);
+			clearances[span] = Layers::narrowest(tile(next), walkable(next, d));
+			if (Layers::open(clearances[span]) != layers)
+			{
+				break;
+			}
+
+			++span;
+		}
+
+		//Units of size s in layer l cross any stretch of tiles with a clearance of at least s in l
+		//from one end to the other, so each such stretch needs one transition, at its widest tile.
+		//Stretches are taken from the narrowest size up, skipping those already crossed.
+		bool used[BlockSize] = {};
+		size_t chosen[BlockSize];
+		size_t count = 0;
+		for (size_t l = 0; l < Layers::Count; ++l)
+		{
+			for (size_t s = 1; s <= MaximumWidth; ++s)
+			{
+				size_t w = 0;
+				while (w < span)
+				{
+					if (Layers::get(clearances[w], l) < s)
+					{
+						++w;
+						continue;
+					}
+
+					size_t first = w;
+					bool crossed = false;
+					size_t widest = 0;
+					for (; w < span && Layers::get(clearances[w], l) >= s; ++w)
+					{
+						crossed = crossed || used[w];
+						widest = std::max(widest, Layers::get(clearances[w], l));
+					}
+
+					if (crossed)
+					{
+						continue;
+					}
+
+					//The middle of the widest tiles.
+					size_t ties = 0;
+					for (size_t t = first; t < w; ++t)
+					{
+						ties += Layers::get(clearances[t], l) == widest;
+					}
+
+					size_t t = first;
+					for (size_t skip = ties / 2; Layers::get(clearances[t], l) != widest || skip > 0; ++t)
+					{
+						skip -= Layers::get(clearances[t], l) == widest;
+					}
+
+					used[t] = true;
+					chosen[count++] = t;
+				}
+			}
+		}
+
+		std::sort(chosen, chosen + count);
+
+		for (size_t k = 0; k < count; ++k)
+		{
+			Portal p;
+			p.start = Index(current.x + iterate.x * chosen[k], current.y + iterate.y * chosen[k]);
+			p.direction = d;
+			p.size = 1;
+			p.passibility = clearances[chosen[k]];
+			out.portals.push_back(p);
+
+			GraphVertex vertex;
+			vertex.start = p;
+
+			Portal next = p;
+			next.start = Index(p.start.x + offsetX[d], p.start.y + offsetY[d]);
+			next.direction = invert[d];
+			vertex.end = next;
+			vertex.length = stepCost(d);
+			vertex.clearance = p.passibility;
+
+			exits.push_back(vertex);
+		}
+
+		i += span - 1;
+	}
+}
+
+void Map::simplifyBlockPortals(Block& block) const
+{
+	RAWR_LOG(Rawr::Debug) << "Starting portal simplification for index [" << block.index << "], Initial size: " << block.portals.size();
+	std::sort(block.portals.begin(), block.portals.end(), [this](const Portal& a, const Portal& b)
+	{
+		return a.start.index(width) < b.start.index(width);
+	});
+
+	//Remove identical portals
+	auto predicate = [](const Portal& a, const Portal& b)
+	{
+		return a.start == b.start &&
+			a.direction == b.direction &&
+			a.size == b.size;
+	};
+
+	block.portals.erase(std::unique(block.portals.begin(), block.portals.end(), predicate), block.portals.end());
+
+	//Collapse portals with
+	RAWR_LOG(Rawr::Debug) << " Resulting Size: " << block.portals.size();
+}
+
+void Map::simplifyGraph()
+{
+
+}
+
+//Block pathfinding policy.
+struct BlockFindPolicy : public Pathfinder::PathfindPolicy<BlockFindPolicy>
+{
+	typedef Index Element;
+	typedef size_t Hash;
+
+	BlockFindPolicy(const Index& start, const Index& end, size_t blockIndex, size_t width, size_t size, size_t layer, const Map * map)
+		:start(start)
+		,end(end)
+		,blockIndex(blockIndex)
+		,width(width)
+		,size(size)
+		,layer(layer)
+		,map(map)
+		,expanded(0)
+	{}
+
+	size_t startingCount()
+	{
+		return 1;
+	}
+
+	const Index& startingPoint(size_t)
+	{
+		return start;
+	}
+
+	size_t startingCost(size_t)
+	{
+		return 0;
+	}
+
+	bool finished(const Index& s)
+	{
+		return s == end;
+	}
+
+	//Block-local, so the search can use flat per-block storage.
+	Hash hash(const Index& ind)
+	{
+		return (ind.x % Map::BlockSize) + (ind.y % Map::BlockSize) * Map::BlockSize;
+	}
+
+	size_t hashRange() const
+	{
+		return Map::BlockSize * Map::BlockSize;
+	}
+
+	size_t predict(const Index& s)
+	{
+		return octile(s, end);
+	}
+
+	size_t neighborCount(const Index& elem)
+	{
+		++expanded;
+		return 8;
+	}
+
+	Index neighbor(const Index& elem, size_t i)
+	{
+		return Index(elem.x + offsetX[gridNeighbors[i]], elem.y + offsetY[gridNeighbors[i]]);
+	}
+
+	size_t cost(const Index&, size_t i)
+	{
+		return stepCost(gridNeighbors[i]);
+	}
+
+	bool passable(const Index& elem)
+	{
+		size_t w = map->passable(elem, layer);
+		if (w < size)
+		{
+			return false;
+		}
+
+		if (map->blockIndex(elem) != blockIndex)
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	Index start;
+	Index end;
+
+	size_t blockIndex;
+	size_t width;
+	size_t size;
+	size_t layer;
+	const Map * map;
+
+	size_t expanded;
+};
+
+//Jump point search within a block. Elements keep the direction they were reached in
+//as their w component. Successors are the next jump points in the directions left after
+//pruning, so open stretches are crossed without expanding the tiles in between.
+//Diagonal steps only need the tile stepped onto, like BlockFindPolicy, and the pruning
+//rules below are those for grids that allow cutting corners.
+struct JumpPointPolicy : public Pathfinder::PathfindPolicy<JumpPointPolicy>
+{
+	typedef Index Element;
+	typedef size_t Hash;
+
+	JumpPointPolicy(const Index& start, const Index& end, size_t blockIndex, size_t size, size_t layer, const Map * map)
+		:start(start.x, start.y)
+		,end(end)
+		,origin(map->blockOrigin(blockIndex))
+		,size(size)
+		,layer(layer)
+		,map(map)
+		,count(0)
+		,expanded(0)
+	{}
+
+	size_t startingCount()
+	{
+		return 1;
+	}
+
+	const Index& startingPoint(size_t)
+	{
+		return start;
+	}
+
+	size_t startingCost(size_t)
+	{
+		return 0;
+	}
+
+	bool finished(const Index& s)
+	{
+		return s.x == end.x && s.y == end.y;
+	}
+
+	Hash hash(const Index& ind)
+	{
+		return (ind.x % Map::BlockSize) + (ind.y % Map::BlockSize) * Map::BlockSize;
+	}
+
+	size_t hashRange() const
+	{
+		return Map::BlockSize * Map::BlockSize;
+	}
+
+	size_t predict(const Index& s)
+	{
+		return octile(s, end);
+	}
+
+	size_t neighborCount(const Index& elem)
+	{
+		++expanded;
+		count = 0;
+
+		int x = elem.x;
+		int y = elem.y;
+		if (elem.w == NONE)
+		{
+			for (size_t i = 0; i < 8; ++i)
+			{
+				add(x, y, offsetX[gridNeighbors[i]], offsetY[gridNeighbors[i]]);
+			}
+
+			return count;
+		}
+
+		int dx = offsetX[elem.w];
+		int dy = offsetY[elem.w];
+		if (dx && dy)
+		{
+			add(x, y, dx, 0);
+			add(x, y, 0, dy);
+			add(x, y, dx, dy);
+			if (!open(x - dx, y) && open(x - dx, y + dy))
+			{
+				add(x, y, -dx, dy);
+			}
+
+			if (!open(x, y - dy) && open(x + dx, y - dy))
+			{
+				add(x, y, dx, -dy);
+			}
+		}
+		else
+		{
+			//The two sides of a straight move.
+			int sx = dy;
+			int sy = dx;
+			add(x, y, dx, dy);
+			if (!open(x + sx, y + sy) && open(x + sx + dx, y + sy + dy))
+			{
+				add(x, y, dx + sx, dy + sy);
+			}
+
+			if (!open(x - sx, y - sy) && open(x - sx + dx, y - sy + dy))
+			{
+				add(x, y, dx - sx, dy - sy);
+			}
+		}
+
+		return count;
+	}
+
+	Index neighbor(const Index&, size_t i)
+	{
+		return successors[i];
+	}
+
+	size_t cost(const Index&, size_t i)
+	{
+		return costs[i];
+	}
+
+	bool passable(const Index& elem)
+	{
+		return open(elem.x, elem.y);
+	}
+
+	bool open(int x, int y) const
+	{
+		if (x < origin.x || y < origin.y || x >= origin.x + int(Map::BlockSize) || y >= origin.y + int(Map::BlockSize))
+		{
+			return false;
+		}
+
+		return map->passable(Index(x, y), layer) >= size;
+	}
+
+	//A tile that must be expanded to go on optimally after a straight or diagonal step.
+	bool forced(int x, int y, int dx, int dy) const
+	{
+		if (dx && dy)
+		{
+			return (!open(x - dx, y) && open(x - dx, y + dy)) || (!open(x, y - dy) && open(x + dx, y - dy));
+		}
+
+		return (!open(x + dy, y + dx) && open(x + dy + dx, y + dx + dy)) ||
+			(!open(x - dy, y - dx) && open(x - dy + dx, y - dx + dy));
+	}
+
+	//Steps from (x, y) until a jump point, the goal or a closed tile. Diagonal moves also
+	//stop where a straight jump along either of their components finds something.
+	bool jump(int& x, int& y, int dx, int dy, size_t& steps) const
+	{
+		for (;;)
+		{
+			x += dx;
+			y += dy;
+			++steps;
+
+			if (!open(x, y))
+			{
+				return false;
+			}
+
+			if ((x == end.x && y == end.y) || forced(x, y, dx, dy))
+			{
+				return true;
+			}
+
+			if (dx && dy)
+			{
+				int sx = x;
+				int sy = y;
+				size_t ignored = 0;
+				if (jump(sx, sy, dx, 0, ignored))
+				{
+					return true;
+				}
+
+				sx = x;
+				sy = y;
+				if (jump(sx, sy, 0, dy, ignored))
+				{
+					return true;
+				}
+			}
+		}
+	}
+
+	void add(int x, int y, int dx, int dy)
+	{
+		size_t steps = 0;
+		if (jump(x, y, dx, dy, steps))
+		{
+			Direction d = static_cast<Direction>(CENTER + dx - 3 * dy);
+			successors[count] = Index(x, y, 0, d);
+			costs[count] = steps * stepCost(d);
+			++count;
+		}
+	}
+
+	Index start;
+	Index end;
+	Index origin;
+
+	size_t size;
+	size_t layer;
+	const Map * map;
+
+	//Successors of the element being expanded, at most one per direction.
+	Index successors[8];
+	size_t costs[8];
+	size_t count;
+
+	size_t expanded;
+};
+
+//Abstract graph pathfinding policy, over one level and optionally confined to one cluster of the level above.
+//Elements are node ids, one past the last node is a virtual goal that every goal link leads to.
+//Without goal links the search never finishes, and settles every node it can reach.
+struct PortalPathfindPolicy : public Pathfinder::PathfindPolicy<PortalPathfindPolicy>
+{
+	typedef boost::uint32_t Element;
+	typedef boost::uint32_t Hash;
+	typedef Map::NodeLink Link;
+	static const bool AbstractGraph = true;
+
+	PortalPathfindPolicy(const Map::NodeLinks& start, const Map::NodeLinks& end, size_t size, size_t layer, size_t level, size_t cluster, const Map * map)
+		:start(start)
+		,end(end)
+		,size(size)
+		,layer(layer)
+		,level(level)
+		,cluster(cluster)
+		,goal(static_cast<boost::uint32_t>(map->nodeTiles.size()))
+		,offsets(map->levels[level].offsets)
+		,edges(map->levels[level].edges)
+		,map(map)
+	{}
+
+	size_t startingCount()
+	{
+		return start.size();
+	}
+
+	boost::uint32_t startingPoint(size_t i)
+	{
+		return start[i].node;
+	}
+
+	size_t startingCost(size_t i)
+	{
+		return start[i].length;
+	}
+
+	bool finished(boost::uint32_t n)
+	{
+		return n == goal;
+	}
+
+	Hash hash(boost::uint32_t n)
+	{
+		return n;
+	}
+
+	size_t hashRange() const
+	{
+		return goal + 1;
+	}
+
+	//Cheapest conceivable route through any of the goal links.
+	size_t predict(boost::uint32_t n)
+	{
+		if (n == goal || end.empty())
+		{
+			return 0;
+		}
+
+		Index at = map->nodeIndex(n);
+		size_t best = Pathfinder::NoPath;
+		for (size_t i = 0; i < end.size(); ++i)
+		{
+			best = std::min(best, octile(at, map->nodeIndex(end[i].node)) + end[i].length);
+		}
+
+		return best;
+	}
+
+	size_t neighborCount(boost::uint32_t n)
+	{
+		if (n == goal)
+		{
+			return 0;
+		}
+
+		size_t degree = offsets[n + 1] - offsets[n];
+		return degree + (goalLink(n) ? 1 : 0);
+	}
+
+	boost::uint32_t neighbor(boost::uint32_t n, size_t i)
+	{
+		size_t e = offsets[n] + i;
+		if (e == offsets[n + 1])
+		{
+			return goal;
+		}
+
+		return edges[e].target;
+	}
+
+	size_t cost(boost::uint32_t n, size_t i)
+	{
+		size_t e = offsets[n] + i;
+		if (e == offsets[n + 1])
+		{
+			return goalLink(n)->length;
+		}
+
+		if (Layers::get(edges[e].clearance, layer) < size)
+		{
+			return Pathfinder::NoPath;
+		}
+
+		return edges[e].length;
+	}
+
+	bool passable(boost::uint32_t n)
+	{
+		if (n == goal || cluster == Map::NoCluster)
+		{
+			return true;
+		}
+
+		return map->clusterOf(map->nodeIndex(n), level + 1) == cluster;
+	}
+
+	const Link * goalLink(boost::uint32_t n) const
+	{
+		for (size_t i = 0; i < end.size(); ++i)
+		{
+			if (end[i].node == n)
+			{
+				return &end[i];
+			}
+		}
+
+		return nullptr;
+	}
+
+	const Map::NodeLinks& start;
+	const Map::NodeLinks& end;
+
+	size_t size;
+	size_t layer;
+	size_t level;
+	size_t cluster;
+	boost::uint32_t goal;
+
+	const Engine::Memory::SharedArray<boost::uint32_t>& offsets;
+	const Engine::Memory::SharedArray<AbstractEdge>& edges;
+	const Map * map;
+};
+
+struct Map::Scratch
+{
+	static const size_t Bytes = 64 * 1024;
+
+	typedef Pathfinder::DenseWorkspace<boost::uint32_t, boost::uint32_t> GraphWorkspace;
+
+	Scratch()
+		:allocator(Bytes, Engine::Memory::StackAllocator::Growable | Engine::Memory::StackAllocator::Reported)
+		,blocks(&allocator, BlockSize * BlockSize)
+	{}
+
+	//Only reallocates when a larger graph than any before is searched.
+	GraphWorkspace& graphWorkspace(size_t range)
+	{
+		if (!graph || graph->range() < range)
+		{
+			graph.reset();
+			graphAllocator.reset();
+
+			size_t bytes = range * (sizeof(GraphWorkspace::Node) + sizeof(GraphWorkspace::Entry)) + 64;
+			graphAllocator.reset(new Engine::Memory::StackAllocator(bytes));
+			graph.reset(new GraphWorkspace(graphAllocator.get(), range));
+		}
+
+		return *graph;
+	}
+
+	Engine::Memory::StackAllocator allocator;
+	Pathfinder::DenseWorkspace<Index, size_t> blocks;
+
+	boost::scoped_ptr<Engine::Memory::StackAllocator> graphAllocator;
+	boost::scoped_ptr<GraphWorkspace> graph;
+};
+
+Map::Scratch& Map::scratch()
+{
+	static thread_local Scratch s;
+	return s;
+}
+
+Engine::Memory::StackAdaptor<char> Map::arena()
+{
+	return Engine::Memory::StackAdaptor<char>(&scratch().allocator);
+}
+
+//Queries made from inside another are left to the outermost recorder.
+class Map::StatsRecorder : boost::noncopyable
+{
+public:
+#ifdef ENABLE_QUERY_STATS
+	StatsRecorder(const Map& map, Pathfinder::QueryStats * out = nullptr)
+		:map(map)
+		,out(out)
+		,nested(Pathfinder::detail::currentStats() != nullptr)
+		,stats()
+	{
+		if (nested)
+		{
+			return;
+		}
+
+		Pathfinder::detail::currentStats() = &stats;
+		Scratch& s = scratch();
+		s.allocator.resetHighWater();
+		if (s.graphAllocator)
+		{
+			s.graphAllocator->resetHighWater();
+		}
+	}
+
+	~StatsRecorder()
+	{
+		if (nested)
+		{
+			return;
+		}
+
+		Pathfinder::detail::currentStats() = nullptr;
+		Scratch& s = scratch();
+		stats.scratchHighWater = s.allocator.highWater() + (s.graphAllocator ? s.graphAllocator->highWater() : 0);
+		{
+			std::lock_guard<std::mutex> hold(map.statsLock);
+			Pathfinder::accumulate(map.statsTotals, stats);
+		}
+
+		if (out)
+		{
+			*out = stats;
+		}
+	}
+private:
+	const Map& map;
+	Pathfinder::QueryStats * out;
+	bool nested;
+	Pathfinder::QueryStats stats;
+#else
+	StatsRecorder(const Map&, Pathfinder::QueryStats * out = nullptr)
+	{
+		if (out)
+		{
+			*out = Pathfinder::QueryStats();
+		}
+	}
+#endif
+};
+
+//This finds a path completely within a single block.
+//Generally used to create a path between portals or between a point and another portal.
+//Returns the path length, or Pathfinder::NoPath. path, if given, is overwritten with the tiles walked.
+size_t Map::blockpathfind(size_t bi, const Index& start, const Index& end, size_t size, size_t layer,
+	std::vector<Index> * foundPath, size_t * expanded) const
+{
+	if (foundPath && searchMethod == JumpPointBlockSearch)
+	{
+		JumpPointPolicy policy(start, end, bi, size, layer, this);
+		size_t length = Pathfinder::pathfind(policy, scratch().blocks, foundPath);
+		if (expanded)
+		{
+			*expanded = policy.expanded;
+		}
+
+		//Fill in the straight and diagonal runs between jump points.
+		if (length != Pathfinder::NoPath)
+		{
+			std::vector<Index> jumps;
+			jumps.swap(*foundPath);
+			foundPath->push_back(start);
+			for (size_t i = 1; i < jumps.size(); ++i)
+			{
+				Index at = foundPath->back();
+				int dx = (jumps[i].x > at.x) - (jumps[i].x < at.x);
+				int dy = (jumps[i].y > at.y) - (jumps[i].y < at.y);
+				while (at.x != jumps[i].x || at.y != jumps[i].y)
+				{
+					at = Index(at.x + dx, at.y + dy);
+					foundPath->push_back(at);
+				}
+			}
+		}
+
+		return length;
+	}
+
+	if (foundPath)
+	{
+		BlockFindPolicy policy(start, end, bi, width, size, layer, this);
+		size_t length = Pathfinder::pathfind(policy, scratch().blocks, foundPath);
+		if (expanded)
+		{
+			*expanded = policy.expanded;
+		}
+
+		return length;
+	}
+
+	//Only the length is wanted, so sweep the block's bitboard instead.
+	if (blockIndex(start) != bi || blockIndex(end) != bi)
+	{
+		return Pathfinder::NoPath;
+	}
+
+	Pathfinder::BlockBoard open;
+	blockBoard(bi, size, layer, open);
+
+	Pathfinder::BlockBoard target;
+	target.clear();
+	target.set(end.x % BlockSize, end.y % BlockSize);
+
+	boost::uint16_t distances[BlockSize * BlockSize];
+	Pathfinder::distanceLayers(open, start.x % BlockSize, start.y % BlockSize, StraightCost, DiagonalCost, target, distances);
+
+	boost::uint16_t length = distances[end.x % BlockSize + (end.y % BlockSize) * BlockSize];
+	return length == Pathfinder::NoDistance ? Pathfinder::NoPath : length;
+}
+
+void Map::blockBoard(size_t bi, size_t size, size_t layer, Pathfinder::BlockBoard& board) const
+{
+	BOOST_STATIC_ASSERT(BlockSize == Pathfinder::BlockBoard::Side);
+
+	Index origin = blockOrigin(bi);
+	size_t height = map.size() / width;
+	size_t columns = std::min<size_t>(BlockSize, width - origin.x);
+	size_t rows = std::min<size_t>(BlockSize, height - origin.y);
+
+	board.clear();
+	for (size_t y = 0; y < rows; ++y)
+	{
+		const boost::uint16_t * row = &map[origin.x + (origin.y + y) * width];
+		boost::uint16_t bits = 0;
+		for (size_t x = 0; x < columns; ++x)
+		{
+			if (Layers::get(row[x], layer) >= size)
+			{
+				bits |= 1 << x;
+			}
+		}
+
+		board.rows[y] = bits;
+	}
+}
+
+
+template<typename Links>
+Map::NodeLinks Map::toNodeLinks(const Links& links) const
+{
+	NodeLinks result(arena());
+	result.reserve(links.size());
+	for (size_t i = 0; i < links.size(); ++i)
+	{
+		NodeLink l = { nodeId(links[i].portal.start), links[i].length };
+		if (l.node != NoNode)
+		{
+			result.push_back(l);
+		}
+	}
+
+	return result;
+}
+
+//Searches a single level, confined to a cluster of the level above unless cluster is NoCluster.
+//path, if given, receives the nodes visited without the virtual goal.
+size_t Map::searchLevel(size_t level, size_t cluster, const NodeLinks& start, const NodeLinks& end,
+	size_t size, size_t layer, NodeRoute * path) const
+{
+	PortalPathfindPolicy policy(start, end, size, layer, level, cluster, this);
+	Scratch::GraphWorkspace& workspace = scratch().graphWorkspace(policy.hashRange());
+
+	size_t length = Pathfinder::pathfind(policy, workspace, path);
+	if (path && length != Pathfinder::NoPath)
+	{
+		path->pop_back();
+	}
+
+	return length;
+}
+
+//Computes the distance from start to every node of the cluster, readable from the workspace afterwards.
+void Map::settleLevel(size_t level, size_t cluster, const NodeLinks& start, size_t size, size_t layer) const
+{
+	NodeLinks none(arena());
+	searchLevel(level, cluster, start, none, size, layer, nullptr);
+}
+
+//Carries links to the nodes of a level-1 cluster up to the nodes of the enclosing level cluster.
+//Edges are symmetric, so this serves goal links as well.
+Map::NodeLinks Map::liftLinks(size_t level, size_t cluster, const NodeLinks& links, size_t size, size_t layer) const
+{
+	settleLevel(level - 1, cluster, links, size, layer);
+	Scratch::GraphWorkspace& workspace = scratch().graphWorkspace(nodeTiles.size() + 1);
+
+	const AbstractLevel& above = levels[level];
+	NodeLinks result(arena());
+	result.reserve(above.clusterOffsets[cluster + 1] - above.clusterOffsets[cluster]);
+	for (size_t i = above.clusterOffsets[cluster]; i < above.clusterOffsets[cluster + 1]; ++i)
+	{
+		NodeLink l = { above.clusterNodes[i], workspace.settled(above.clusterNodes[i]) };
+		if (l.length != Pathfinder::NoPath)
+		{
+			result.push_back(l);
+		}
+	}
+
+	return result;
+}
+
+//Expands a route on the given level into the nodes of the level below, including
+//the stretches from the links below to the first node and, unless end is empty, from the last node on.
+//False, leaving route as it was, if some stretch has no path on the level below.
+bool Map::refineRoute(size_t level, NodeRoute& route, const NodeLinks& start, const NodeLinks& end,
+	const Index& from, const Index& to, size_t size, size_t layer) const
+{
+	NodeRoute result(arena());
+	NodeRoute piece(arena());
+	NodeLinks single(1, NodeLink(), arena());
+	NodeLinks other(1, NodeLink(), arena());
+
+	single[0].node = route.front();
+	single[0].length = 0;
+	if (searchLevel(level - 1, clusterOf(from, level), start, single, size, layer, &result) == Pathfinder::NoPath)
+	{
+		return false;
+	}
+
+	for (size_t i = 1; i < route.size(); ++i)
+	{
+		size_t cluster = clusterOf(nodeIndex(route[i - 1]), level);
+		if (cluster != clusterOf(nodeIndex(route[i]), level))
+		{
+			result.push_back(route[i]);
+			continue;
+		}
+
+		single[0].node = route[i - 1];
+		other[0].node = route[i];
+		other[0].length = 0;
+		if (searchLevel(level - 1, cluster, single, other, size, layer, &piece) == Pathfinder::NoPath)
+		{
+			return false;
+		}
+
+		result.insert(result.end(), piece.begin() + 1, piece.end());
+	}
+
+	if (!end.empty())
+	{
+		single[0].node = route.back();
+		if (searchLevel(level - 1, clusterOf(to, level), single, end, size, layer, &piece) == Pathfinder::NoPath)
+		{
+			return false;
+		}
+
+		result.insert(result.end(), piece.begin() + 1, piece.end());
+	}
+
+	route.swap(result);
+	return true;
+}
+
+//Given the level 0 links in starts[0] and ends[0], picks the highest level separating from and to
+//and fills in the links on every level up to it. False if either end cannot reach that level.
+//New levels take the allocator of starts and ends, whatever the lifted links are made on.
+bool Map::liftQuery(const Index& from, const Index& to, LevelLinks& starts, LevelLinks& ends, size_t size, size_t layer) const
+{
+	size_t top = levels.size() - 1;
+	while (top > 0 && clusterOf(from, top) == clusterOf(to, top))
+	{
+		--top;
+	}
+
+	starts.resize(top + 1, NodeLinks(starts.get_allocator()));
+	ends.resize(top + 1, NodeLinks(ends.get_allocator()));
+	for (size_t k = 1; k <= top; ++k)
+	{
+		starts[k] = liftLinks(k, clusterOf(from, k), starts[k - 1], size, layer);
+		ends[k] = liftLinks(k, clusterOf(to, k), ends[k - 1], size, layer);
+
+		if (starts[k].empty() || ends[k].empty())
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//This finds a path between two sets of portals.
+size_t Map::portalPathfind(const std::vector<PortalLink>& origins, const std::vector<PortalLink>& goals, size_t size,
+	boost::uint8_t capabilities, std::vector<Index> * path) const
+{
+	StatsRecorder recorder(*this);
+	size_t layer = Layers::forCapabilities(capabilities);
+	if (layer == Layers::None)
+	{
+		return Pathfinder::NoPath;
+	}
+
+	Engine::Memory::StackScope scope(&scratch().allocator);
+	return routeBetween(origins, goals, size, layer, path);
+}
+
+//Needs a StackScope open on the scratch memory.
+template<typename Links, typename Path>
+size_t Map::routeBetween(const Links& origins, const Links& goals, size_t size, size_t layer, Path * path) const
+{
+	LevelLinks starts(1, toNodeLinks(origins), arena());
+	LevelLinks ends(1, toNodeLinks(goals), arena());
+	if (starts[0].empty() || ends[0].empty())
+	{
+		return Pathfinder::NoPath;
+	}
+
+	Index from = origins.front().portal.start;
+	Index to = goals.front().portal.start;
+	if (!liftQuery(from, to, starts, ends, size, layer))
+	{
+		return Pathfinder::NoPath;
+	}
+
+	size_t top = starts.size() - 1;
+
+	NodeRoute route(arena());
+	size_t length = searchLevel(top, NoCluster, starts[top], ends[top], size, layer, path ? &route : nullptr);
+	if (!path)
+	{
+		return length;
+	}
+
+	path->clear();
+	if (length == Pathfinder::NoPath)
+	{
+		return length;
+	}
+
+	for (size_t k = top; k > 0; --k)
+	{
+		if (!refineRoute(k, route, starts[k - 1], ends[k - 1], from, to, size, layer))
+		{
+			return Pathfinder::NoPath;
+		}
+	}
+
+	for (size_t i = 0; i < route.size(); ++i)
+	{
+		path->push_back(nodeIndex(route[i]));
+	}
+
+	return length;
+}
+
+size_t Map::findPath(const OriginAndGoal& query, size_t size, boost::uint8_t capabilities, std::vector<Index> * path,
+	Pathfinder::QueryStats * stats) const
+{
+	StatsRecorder recorder(*this, stats);
+	Engine::Memory::StackScope scope(&scratch().allocator);
+	if (path)
+	{
+		path->clear();
+	}
+
+	size_t layer = Layers::forCapabilities(capabilities);
+	if (layer == Layers::None || passable(query.origin, layer) < size || passable(query.goal, layer) < size)
+	{
+		return Pathfinder::NoPath;
+	}
+
+	//Inside one block the direct path may beat any route through the portals.
+	size_t direct = Pathfinder::NoPath;
+	size_t bi = blockIndex(query.origin);
+	if (bi == blockIndex(query.goal))
+	{
+		direct = blockpathfind(bi, query.origin, query.goal, size, layer, nullptr);
+	}
+
+	RoutePortals route(arena());
+	size_t length = Pathfinder::NoPath;
+	bool keep = routes->capacity() > 0;
+
+	//A route kept from an earlier query between the same blocks only needs its ends linked.
+	RouteKey key = { bi, blockIndex(query.goal), size, layer };
+	size_t between = 0;
+	bool reused = keep && routes->find(key, route, between);
+	if (reused)
+	{
+		size_t first = linkDistance(key.originBlock, query.origin, route.front(), size, layer);
+		size_t last = linkDistance(key.goalBlock, query.goal, route.back(), size, layer);
+		if (first == Pathfinder::NoPath || last == Pathfinder::NoPath)
+		{
+			routes->reject(key);
+			route.clear();
+			reused = false;
+		}
+		else
+		{
+			length = first + between + last;
+		}
+	}
+
+	if (!reused)
+	{
+		PortalLinks origins(arena());
+		PortalLinks goals(arena());
+		linkPortals(query.origin, size, layer, origins);
+		linkPortals(query.goal, size, layer, goals);
+		length = routeBetween(origins, goals, size, layer, (path || keep) ? &route : nullptr);
+
+		//Only a route kept for later queries goes to the heap.
+		if (keep && length != Pathfinder::NoPath)
+		{
+			CachedRoute cached;
+			cached.length = length - shortestLink(origins, route.front()) - shortestLink(goals, route.back());
+			cached.portals.assign(route.begin(), route.end());
+			cached.blocks.push_back(key.originBlock);
+			cached.blocks.push_back(key.goalBlock);
+			for (size_t i = 0; i < route.size(); ++i)
+			{
+				cached.blocks.push_back(blockIndex(route[i]));
+			}
+
+			std::sort(cached.blocks.begin(), cached.blocks.end());
+			cached.blocks.erase(std::unique(cached.blocks.begin(), cached.blocks.end()), cached.blocks.end());
+			routes->insert(key, cached);
+		}
+	}
+
+	if (direct <= length)
+	{
+		route.clear();
+		length = direct;
+	}
+
+	if (path && length != Pathfinder::NoPath)
+	{
+		path->push_back(query.origin);
+		path->insert(path->end(), route.begin(), route.end());
+		path->push_back(query.goal);
+	}
+
+	return length;
+}
+
+void Map::findPaths(Engine::Threading::WorkStealingPool& pool, const OriginAndGoal * queries, size_t count, size_t size,
+	boost::uint8_t capabilities, size_t * lengths, std::vector<Index> * paths) const
+{
+	pool.parallelFor(count, [=](size_t i)
+	{
+		lengths[i] = findPath(queries[i], size, capabilities, paths ? &paths[i] : nullptr);
+	});
+}
+
+struct RouteSearch::State
+{
+	typedef Pathfinder::IncrementalSearch<PortalPathfindPolicy> Search;
+
+	State(const Map& map, const OriginAndGoal& query, size_t size, boost::uint8_t capabilities,
+		Engine::Memory::StackAllocator * allocator)
+		:map(&map)
+		,query(query)
+		,size(size)
+		,capabilities(capabilities)
+		,layer(Layers::forCapabilities(capabilities))
+		,starts(Engine::Memory::StackAdaptor<Map::NodeLinks>(allocator))
+		,ends(Engine::Memory::StackAdaptor<Map::NodeLinks>(allocator))
+		,direct(Pathfinder::NoPath)
+		,policy(nullptr)
+		,search(nullptr)
+	{}
+
+	const Map * map;
+	OriginAndGoal query;
+	size_t size;
+	boost::uint8_t capabilities;
+	size_t layer;
+
+	//On the allocator of the search, as they outlive the scratch memory of any one call.
+	Map::LevelLinks starts;
+	Map::LevelLinks ends;
+
+	//Inside one block the direct path is known up front.
+	size_t direct;
+	std::vector<Index> directPath;
+
+	PortalPathfindPolicy * policy;
+	Search * search;
+};
+
+size_t RouteSearch::bytesRequired(const Map& map)
+{
+	//No end links more nodes than a block has portals or a cluster has nodes.
+	size_t links = 0;
+	for (size_t i = 0; i < map.blockCount(); ++i)
+	{
+		links = std::max(links, map.viewOf(i).portalCount);
+	}
+
+	for (size_t k = 1; k < map.levels.size(); ++k)
+	{
+		const AbstractLevel& level = map.levels[k];
+		for (size_t c = 0; c + 1 < level.clusterOffsets.size(); ++c)
+		{
+			links = std::max<size_t>(links, level.clusterOffsets[c + 1] - level.clusterOffsets[c]);
+		}
+	}
+
+	size_t ends = map.levels.size() * (sizeof(Map::NodeLinks) + links * sizeof(Map::NodeLink) + 16) + 16;
+	return sizeof(State) + sizeof(PortalPathfindPolicy) + sizeof(State::Search) + 256 + 2 * ends +
+		State::Search::bytesRequired(map.nodeTiles.size() + 1);
+}
+
+RouteSearch::RouteSearch(const Map& map, const OriginAndGoal& query, size_t size, boost::uint8_t capabilities,
+	Engine::Memory::StackAllocator * allocator)
+	:scope(allocator)
+	,state(scope.create<State>(map, query, size, capabilities, allocator))
+{
+	size_t layer = state->layer;
+	if (layer == Layers::None || map.passable(query.origin, layer) < size || map.passable(query.goal, layer) < size)
+	{
+		return;
+	}
+
+	size_t bi = map.blockIndex(query.origin);
+	if (bi == map.blockIndex(query.goal))
+	{
+		state->direct = map.blockpathfind(bi, query.origin, query.goal, size, layer, &state->directPath);
+	}
+
+	//Links are worked out on the scratch memory, and copied over as each level is kept.
+	Engine::Memory::StackScope temporaries(&Map::scratch().allocator);
+	Map::PortalLinks origins(Map::arena());
+	Map::PortalLinks goals(Map::arena());
+	map.linkPortals(query.origin, size, layer, origins);
+	map.linkPortals(query.goal, size, layer, goals);
+
+	Map::NodeLinks start = map.toNodeLinks(origins);
+	Map::NodeLinks end = map.toNodeLinks(goals);
+	state->starts.push_back(Map::NodeLinks(start.begin(), start.end(), state->starts.get_allocator()));
+	state->ends.push_back(Map::NodeLinks(end.begin(), end.end(), state->ends.get_allocator()));
+	if (state->starts[0].empty() || state->ends[0].empty() ||
+		!map.liftQuery(query.origin, query.goal, state->starts, state->ends, size, layer))
+	{
+		return;
+	}
+
+	size_t top = state->starts.size() - 1;
+	size_t cluster = Map::NoCluster;
+	state->policy = scope.create<PortalPathfindPolicy>(state->starts[top], state->ends[top], size, layer, top, cluster, &map);
+	state->search = scope.create<State::Search>(*state->policy, allocator);
+}
+
+RouteSearch::~RouteSearch()
+{}
+
+bool RouteSearch::step(size_t maxExpansions)
+{
+	if (done())
+	{
+		return true;
+	}
+
+	return state->search->step(maxExpansions) != Pathfinder::Searching;
+}
+
+bool RouteSearch::done() const
+{
+	return !state->search || state->search->state() != Pathfinder::Searching;
+}
+
+size_t RouteSearch::length() const
+{
+	if (!done())
+	{
+		return Pathfinder::NoPath;
+	}
+
+	size_t abstract = state->search ? state->search->length() : Pathfinder::NoPath;
+	return std::min(state->direct, abstract);
+}
+
+size_t RouteSearch::route(std::vector<Index> * path) const
+{
+	const Map& map = *state->map;
+	const OriginAndGoal& query = state->query;
+	size_t size = state->size;
+	size_t layer = state->layer;
+
+	path->clear();
+
+	//A direct path is complete, so it is walked until a cheaper route turns up.
+	size_t abstract = done() && state->search ? state->search->length() : Pathfinder::NoPath;
+	if (state->direct != Pathfinder::NoPath && state->direct <= abstract)
+	{
+		*path = state->directPath;
+		return state->direct;
+	}
+
+	if (!state->search || state->search->state() == Pathfinder::Failed)
+	{
+		return Pathfinder::NoPath;
+	}
+
+	Engine::Memory::StackScope temporaries(&Map::scratch().allocator);
+	size_t top = state->starts.size() - 1;
+	Map::NodeRoute nodes(Map::arena());
+	size_t cost;
+	if (abstract != Pathfinder::NoPath)
+	{
+		//Complete, so the whole route is refined down to the portals.
+		state->search->path(&nodes);
+		nodes.pop_back();
+		cost = abstract;
+
+		for (size_t k = top; k > 0; --k)
+		{
+			if (!map.refineRoute(k, nodes, state->starts[k - 1], state->ends[k - 1], query.origin, query.goal, size, layer))
+			{
+				return Pathfinder::NoPath;
+			}
+		}
+	}
+	else
+	{
+		cost = state->search->partial(&nodes);
+		if (nodes.empty())
+		{
+			path->push_back(query.origin);
+			return 0;
+		}
+
+		//Only the first hop is refined, the others stay abstract until the search is done.
+		Map::NodeLinks none(Map::arena());
+		Map::NodeRoute head(1, nodes.front(), Map::arena());
+		for (size_t k = top; k > 0; --k)
+		{
+			if (!map.refineRoute(k, head, state->starts[k - 1], none, query.origin, query.goal, size, layer))
+			{
+				return Pathfinder::NoPath;
+			}
+		}
+
+		head.insert(head.end(), nodes.begin() + 1, nodes.end());
+		nodes.swap(head);
+	}
+
+	map.blockpathfind(map.blockIndex(query.origin), query.origin, map.nodeIndex(nodes.front()), size, layer, path);
+	for (size_t i = 1; i < nodes.size(); ++i)
+	{
+		path->push_back(map.nodeIndex(nodes[i]));
+	}
+
+	if (abstract != Pathfinder::NoPath)
+	{
+		path->push_back(query.goal);
+	}
+
+	return cost;
+}
+
+//Generates all the portal links within a single block.
+void Map::innerblockPathfind(const Block& block, std::vector<GraphVertex>& inner) const
+{
+	//Layers with the same clearance on every tile of the block get the same paths.
+	size_t same[Layers::Count];
+	equalLayers(blockOrigin(block.index), BlockSize, same);
+
+	//Corner portals may start outside the block, nothing inside it leads to those.
+	BlockView view = viewOf(block);
+	size_t count = block.portals.size();
+	std::vector<bool> inside(count);
+	Pathfinder::BlockBoard targets;
+	targets.clear();
+	for (size_t i = 0; i < count; ++i)
+	{
+		inside[i] = blockIndex(block.portals[i].start) == block.index;
+		if (inside[i])
+		{
+			targets.set(block.portals[i].start.x % BlockSize, block.portals[i].start.y % BlockSize);
+		}
+	}
+
+	Pathfinder::BlockBoard boards[Layers::Count][MaximumWidth];
+	for (size_t l = 0; l < Layers::Count && block.fieldOf.empty(); ++l)
+	{
+		for (size_t s = 1; s <= MaximumWidth && same[l] == l; ++s)
+		{
+			blockBoard(block.index, s, l, boards[l][s - 1]);
+		}
+	}
+
+	std::vector<size_t> lengths(Layers::Count * MaximumWidth);
+	std::vector<size_t> sweeps(Layers::Count * MaximumWidth * count);
+	std::vector<std::pair<size_t, boost::uint16_t> > packed;
+	boost::uint16_t distances[BlockSize * BlockSize];
+
+	//Lengths are in half-tiles, moving diagonally costs 1.5 movement.
+	for (size_t i = 0; i < count; ++i)
+	{
+		//One sweep per layer and size gives the lengths from this portal to all the others.
+		const Index& a = block.portals[i].start;
+		for (size_t l = 0; l < Layers::Count; ++l)
+		{
+			for (size_t s = 1; s <= MaximumWidth; ++s)
+			{
+				size_t * row = &sweeps[(l * MaximumWidth + s - 1) * count];
+				if (same[l] != l)
+				{
+					const size_t * equal = &sweeps[(same[l] * MaximumWidth + s - 1) * count];
+					std::copy(equal, equal + count, row);
+					continue;
+				}
+
+				if (!block.fieldOf.empty())
+				{
+					for (size_t j = 0; j < count; ++j)
+					{
+						row[j] = tableDistance(view, i, block.portals[j].start, s, l);
+					}
+
+					continue;
+				}
+
+				if (!inside[i] || s > passable(a, l))
+				{
+					std::fill(row, row + count, Pathfinder::NoPath);
+					continue;
+				}
+
+				Pathfinder::distanceLayers(boards[l][s - 1], a.x % BlockSize, a.y % BlockSize, StraightCost, DiagonalCost, targets, distances);
+				for (size_t j = 0; j < count; ++j)
+				{
+					const Index& b = block.portals[j].start;
+					boost::uint16_t d = distances[b.x % BlockSize + (b.y % BlockSize) * BlockSize];
+					row[j] = (!inside[j] || d == Pathfinder::NoDistance) ? Pathfinder::NoPath : d;
+				}
+			}
+		}
+
+		for (size_t j = 0; j < count; ++j)
+		{
+			if (i != j)
+			{
+				//Wider units may need longer paths. Emit one edge per distinct length, tagged
+				//with the widest unit size of each layer that gets a path at most that long.
+				for (size_t k = 0; k < lengths.size(); ++k)
+				{
+					lengths[k] = sweeps[k * count + j];
+				}
+
+				packLengths(lengths, MaximumWidth, packed);
+				for (size_t k = 0; k < packed.size(); ++k)
+				{
+					GraphVertex vert;
+					vert.start = block.portals[i];
+					vert.end = block.portals[j];
+					vert.length = packed[k].first;
+					vert.clearance = packed[k].second;
+					inner.push_back(vert);
+				}
+			}
+		}
+	}
+}
+
+void Map::buildPortalTable(Block& block) const
+{
+	static const size_t Classes = Layers::Count * MaximumWidth;
+	static const size_t Tiles = BlockSize * BlockSize;
+
+	block.fieldOf.clear();
+	block.narrowFields.clear();
+	block.wideFields.clear();
+
+	size_t count = block.portals.size();
+	if (tableLimit == 0 || count == 0)
 	{
-		return c == '|' || c == '-';
+		return;
 	}
 
-	static const int offsetX[] = {0, -1, 0, 1, -1, 0, 1, -1, 0, 1, 0, 0};
-	static const int offsetY[] = {0, 1, 1, 1, 0, 0, 0, -1, -1, -1, 0, 0};
-	static const char * directionName[] = {"", "SW", "S", "SE", "W", "C", "E", "NW", "N", "NW", "U", "D"};
-	static const Direction invert[] = {
-		NONE, NORTHEAST, NORTH, NORTHWEST, EAST, CENTER, WEST, SOUTHEAST, SOUTH, SOUTHWEST, DOWN, UP
-	};
-}
+	//Layers and sizes that see the same open tiles share their fields.
+	Pathfinder::BlockBoard boards[Classes];
+	size_t first[Classes];
+	size_t fieldCount = 0;
+	for (size_t c = 0; c < Classes; ++c)
+	{
+		blockBoard(block.index, c % MaximumWidth + 1, c / MaximumWidth, boards[c]);
 
-Index::Index()
-{}
+		first[c] = c;
+		for (size_t k = 0; k < c && first[c] == c; ++k)
+		{
+			if (first[k] == k && std::equal(boards[c].rows, boards[c].rows + BlockSize, boards[k].rows))
+			{
+				first[c] = k;
+			}
+		}
 
-Index::Index(boost::uint16_t x, boost::uint16_t y, boost::uint16_t z, boost::uint16_t w)
-	:x(x), y(y), z(z), w(w)
-{}
+		for (size_t p = 0; p < count && first[c] == c; ++p)
+		{
+			const Index& start = block.portals[p].start;
+			if (blockIndex(start) == block.index && boards[c].test(start.x % BlockSize, start.y % BlockSize))
+			{
+				++fieldCount;
+			}
+		}
+	}
 
-bool Index::operator==(const Index& i) const
-{
-	return x == i.x && y == i.y && z == i.z && w == i.w;
-}
+	size_t indexBytes = Classes * count * sizeof(boost::uint16_t);
+	if (indexBytes + fieldCount * Tiles > tableLimit)
+	{
+		return;
+	}
 
-Index Index::fromIndex(size_t i, size_t w)
-{
-	return Index(i % w, i / w, 0, 0);
+	std::vector<boost::uint16_t> fields(fieldCount * Tiles);
+	std::vector<boost::uint16_t> fieldOf(Classes * count, NoField);
+	size_t next = 0;
+	Pathfinder::BlockBoard everywhere;
+	everywhere.clear();
+	for (size_t c = 0; c < Classes; ++c)
+	{
+		if (first[c] != c)
+		{
+			std::copy(fieldOf.begin() + first[c] * count, fieldOf.begin() + (first[c] + 1) * count, fieldOf.begin() + c * count);
+			continue;
+		}
+
+		for (size_t p = 0; p < count; ++p)
+		{
+			const Index& start = block.portals[p].start;
+			if (blockIndex(start) == block.index && boards[c].test(start.x % BlockSize, start.y % BlockSize))
+			{
+				Pathfinder::distanceLayers(boards[c], start.x % BlockSize, start.y % BlockSize, StraightCost, DiagonalCost,
+					everywhere, &fields[next * Tiles]);
+				fieldOf[c * count + p] = static_cast<boost::uint16_t>(next++);
+			}
+		}
+	}
+
+	//A byte per tile holds every distance of open or simply shaped blocks.
+	bool narrow = true;
+	for (size_t i = 0; i < fields.size() && narrow; ++i)
+	{
+		narrow = fields[i] < 0xFF || fields[i] == Pathfinder::NoDistance;
+	}
+
+	if (narrow)
+	{
+		block.narrowFields.resize(fields.size());
+		for (size_t i = 0; i < fields.size(); ++i)
+		{
+			block.narrowFields[i] = fields[i] == Pathfinder::NoDistance ? 0xFF : static_cast<boost::uint8_t>(fields[i]);
+		}
+	}
+	else if (indexBytes + fields.size() * sizeof(boost::uint16_t) <= tableLimit)
+	{
+		block.wideFields.swap(fields);
+	}
+	else
+	{
+		return;
+	}
+
+	block.fieldOf.swap(fieldOf);
 }
 
-size_t Index::index(size_t w) const
+Map::BlockView Map::viewOf(const Block& block) const
 {
-	return x + y * w;
+	BlockView view = {
+		block.index, block.portals.data(), block.portals.size(),
+		block.fieldOf.empty() ? nullptr : block.fieldOf.data(),
+		block.narrowFields.empty() ? nullptr : block.narrowFields.data(),
+		block.wideFields.empty() ? nullptr : block.wideFields.data()
+	};
+
+	return view;
 }
 
-bool Portal::operator==(const Portal& other) const
+Map::BlockView Map::viewOf(size_t bi) const
 {
-	return start == other.start;
+	if (pager)
+	{
+		pager->touch(pageOf(bi));
+	}
+
+	const BlockRecord& record = blocks[bi];
+	BlockView view = { bi, portals.data() + record.portals, record.portalCount, nullptr, nullptr, nullptr };
+	if (record.table != NoTable)
+	{
+		view.fieldOf = fieldOf.data() + record.fieldOf;
+	}
+
+	if (record.table == NarrowTable)
+	{
+		view.narrowFields = narrowFields.data() + record.fields;
+	}
+	else if (record.table == WideTable)
+	{
+		view.wideFields = wideFields.data() + record.fields;
+	}
+
+	return view;
 }
 
-std::ostream& operator<<(std::ostream& o, const Index& ind)
+size_t Map::tableDistance(const BlockView& block, size_t p, const Index& ind, size_t size, size_t layer) const
 {
-	o << "(" << ind.x << ", " << ind.y << ")";
-	return o;
+	boost::uint16_t field = block.fieldOf[(layer * MaximumWidth + size - 1) * block.portalCount + p];
+	if (field == NoField || blockIndex(ind) != block.index)
+	{
+		return Pathfinder::NoPath;
+	}
+
+	size_t tile = field * BlockSize * BlockSize + ind.x % BlockSize + (ind.y % BlockSize) * BlockSize;
+	if (block.narrowFields)
+	{
+		return block.narrowFields[tile] == 0xFF ? Pathfinder::NoPath : block.narrowFields[tile];
+	}
+
+	return block.wideFields[tile] == Pathfinder::NoDistance ? Pathfinder::NoPath : block.wideFields[tile];
 }
 
-std::ostream& operator<<(std::ostream& o, const Portal& ind)
+size_t Map::linkDistance(size_t bi, const Index& from, const Index& portal, size_t size, size_t layer) const
 {
-	o << ind.start << " " << directionName[ind.direction] << " " << ind.size;
-	return o;
+	BlockView block = viewOf(bi);
+	PATHFINDER_STAT(++queryStats->links);
+	if (!block.fieldOf)
+	{
+		PATHFINDER_STAT(++queryStats->linkSearches);
+		return blockpathfind(bi, from, portal, size, layer, nullptr);
+	}
+
+	size_t shortest = Pathfinder::NoPath;
+	for (size_t p = 0; p < block.portalCount; ++p)
+	{
+		if (block.portals[p].start == portal)
+		{
+			shortest = std::min(shortest, tableDistance(block, p, from, size, layer));
+		}
+	}
+
+	return shortest;
 }
 
-OriginAndGoal Map::loadFromStream(std::istream& input)
+void Map::equalLayers(const Index& origin, size_t side, size_t * same) const
 {
-	std::string s;
-	std::getline(input, s);
-	s.erase(std::remove_if(s.begin(), s.end(), isSeperator), s.end());
-
-	width = s.size();
-	map.reserve(width * 32);
+	size_t height = map.size() / width;
+	size_t x1 = std::min<size_t>(origin.x + side, width);
+	size_t y1 = std::min<size_t>(origin.y + side, height);
 
-	OriginAndGoal res;
-	do
+	for (size_t l = 0; l < Layers::Count; ++l)
 	{
-		s.erase(std::remove_if(s.begin(), s.end(), isSeperator), s.end());
-		for (size_t i = 0; i < s.size(); ++i)
+		same[l] = l;
+		for (size_t other = 0; other < l && same[l] == l; ++other)
 		{
-			size_t value = MaximumWidth;
-			if (s[i] == '0')
+			if (same[other] != other)
 			{
-				value = 0;
+				continue;
 			}
 
-			if (s[i] == 'G')
+			bool equal = true;
+			for (size_t y = origin.y; y < y1 && equal; ++y)
 			{
-				res.goal = Index::fromIndex(map.size(), width);
+				for (size_t x = origin.x; x < x1; ++x)
+				{
+					boost::uint16_t t = map[x + y * width];
+					if (Layers::get(t, l) != Layers::get(t, other))
+					{
+						equal = false;
+						break;
+					}
+				}
 			}
 
-			if (s[i] == 'S')
+			if (equal)
 			{
-				res.origin = Index::fromIndex(map.size(), width);
+				same[l] = other;
 			}
-
-			map.push_back(value);
 		}
+	}
+}
 
-		std::getline(input, s);
-	} while (input);
+std::vector<PortalLink> Map::linkPositionAndPortals(const Index& ind, size_t size, boost::uint8_t capabilities) const
+{
+	StatsRecorder recorder(*this);
+	size_t layer = Layers::forCapabilities(capabilities);
 
-	preprocess();
-	return res;
+	std::vector<PortalLink> result;
+	if (layer != Layers::None)
+	{
+		linkPortals(ind, size, layer, result);
+	}
+
+	return result;
 }
 
-size_t Map::walkable(const Index& ind, Direction direction) const
+template<typename Links>
+void Map::linkPortals(const Index& ind, size_t size, size_t layer, Links& result) const
 {
-	int x = static_cast<int>(ind.x);
-	int y = static_cast<int>(ind.y);
-	size_t height = map.size() / width;
+	size_t bi = blockIndex(ind);
+	BlockView block = viewOf(bi);
+	result.reserve(result.size() + block.portalCount);
 
-	x += offsetX[direction];
-	y += offsetY[direction];
+	PATHFINDER_STAT(++queryStats->links);
 
-	if (x < 0 || y < 0)
+	if (block.fieldOf)
 	{
-		return 0;
+		for (size_t i = 0; i < block.portalCount; ++i)
+		{
+			size_t path = tableDistance(block, i, ind, size, layer);
+			if (path != Pathfinder::NoPath)
+			{
+				PortalLink link = { block.portals[i], path };
+				result.push_back(link);
+			}
+		}
+
+		return;
 	}
 
-	if (x >= width || y >= height)
+	//Without a table, a single sweep of the block reaches every portal.
+	PATHFINDER_STAT(++queryStats->linkSearches);
+	Pathfinder::BlockBoard open;
+	Pathfinder::BlockBoard targets;
+	blockBoard(bi, size, layer, open);
+	targets.clear();
+	for (size_t i = 0; i < block.portalCount; ++i)
 	{
-		return 0;
+		if (blockIndex(block.portals[i].start) == bi)
+		{
+			targets.set(block.portals[i].start.x % BlockSize, block.portals[i].start.y % BlockSize);
+		}
 	}
 
-	return map[Index(x, y).index(width)];
-}
+	boost::uint16_t distances[BlockSize * BlockSize];
+	Pathfinder::distanceLayers(open, ind.x % BlockSize, ind.y % BlockSize, StraightCost, DiagonalCost, targets, distances);
 
-size_t Map::passable(const Index& ind) const
-{
-	if (ind.x >= width || ind.x < 0)
+	for (size_t i = 0; i < block.portalCount; ++i)
 	{
-		return 0;
+		const Index& p = block.portals[i].start;
+		boost::uint16_t path = distances[p.x % BlockSize + (p.y % BlockSize) * BlockSize];
+		if (blockIndex(p) == bi && path != Pathfinder::NoDistance)
+		{
+			PortalLink link = { block.portals[i], path };
+			result.push_back(link);
+		}
 	}
+}
 
-	if (ind.y >= map.size() / width || ind.y < 0)
-	{
-		return 0;
-	}
+void Map::createBlockData(size_t bi, Block& block, std::vector<GraphVertex>& exits) const
+{
+	size_t blockWidth = width / BlockSize;
+	size_t startX = (bi % blockWidth) * BlockSize;
+	size_t startY = (bi / blockWidth) * BlockSize;
 
-	return map[ind.index(width)];
+	//For this block, compute the exits.
+	//Compute exits for the given border, going in the border direction.
+	block = Block();
+	block.index = bi;
+	createPortalsInBlock(block, Index(startX, startY), Index(1, 0), NORTH, BlockSize, exits);
+	createPortalsInBlock(block, Index(startX, startY), Index(0, 1), WEST, BlockSize, exits);
+	createPortalsInBlock(block, Index(startX, startY + BlockSize - 1), Index(1, 0), SOUTH, BlockSize, exits);
+	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY), Index(0, 1), EAST, BlockSize, exits);
+
+	//Compute exits for the corners.
+	createPortalsInBlock(block, Index(startX, startY), Index(1, 0), NORTHWEST, 1, exits);
+	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY), Index(1, 0), NORTHEAST, 1, exits);
+	createPortalsInBlock(block, Index(startX, startY + BlockSize - 1), Index(1, 0), SOUTHWEST, BlockSize, exits);
+	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY + BlockSize - 1), Index(1, 0), SOUTHEAST, BlockSize, exits);
+
+	//Compute exits for all up/down transitions.
+	createPortalsInBlock(block, Index(startX+1, startY), Index(1, 0), NORTHWEST, BlockSize - 1, exits);
+	createPortalsInBlock(block, Index(startX, startY), Index(1, 0), NORTHEAST, BlockSize - 1, exits);
+
+	createPortalsInBlock(block, Index(startX, startY+1), Index(0, 1), NORTHWEST, BlockSize - 1, exits);
+	createPortalsInBlock(block, Index(startX, startY), Index(0, 1), SOUTHWEST, BlockSize - 1, exits);
+
+	createPortalsInBlock(block, Index(startX+1, startY + BlockSize - 1), Index(1, 0), SOUTHWEST, BlockSize - 1, exits);
+	createPortalsInBlock(block, Index(startX, startY + BlockSize - 1), Index(1, 0), SOUTHEAST, BlockSize - 1, exits);
+
+	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY+1), Index(0, 1), NORTHEAST, BlockSize - 1, exits);
+	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY), Index(0, 1), SOUTHEAST, BlockSize - 1, exits);
 }
 
-size_t Map::blockIndex(const Index& ind) const
+//Everything a block contributes to the graph, independent of other blocks once clearance is known.
+void Map::buildBlock(size_t bi, Block& block, std::vector<GraphVertex>& exits, std::vector<GraphVertex>& inner) const
 {
-	size_t blockWidth = width / BlockSize;
-	size_t blockX = (ind.x / BlockSize);
-	size_t blockY = (ind.y / BlockSize);
+	createBlockData(bi, block, exits);
+	simplifyBlockPortals(block);
+	buildPortalTable(block);
+	innerblockPathfind(block, inner);
+}
 
-	return blockX + blockY * blockWidth;
+size_t Map::blockCount() const
+{
+	return map.size() / (BlockSize * BlockSize);
 }
 
-size_t Map::maximumPassibility(size_t index) const
+size_t Map::pageOf(size_t bi) const
 {
-	size_t height = map.size() / width;
-	size_t baseX = index % width;
-	size_t baseY = index / width;
+	size_t blockWidth = width / BlockSize;
+	size_t pagesAcross = (blockWidth + PageBlocks - 1) / PageBlocks;
+	return (bi % blockWidth) / PageBlocks + (bi / blockWidth) / PageBlocks * pagesAcross;
+}
 
-	if (map[index] == 0)
+void Map::startPaging()
+{
+	pager.reset();
+	if (!mapping || !portals.isBorrowed() || pageLimit == 0)
 	{
-		return 0;
+		return;
 	}
 
-	for (size_t i = 1; i < MaximumWidth; ++i)
-	{
-		if (baseX + i >= width)
-		{
-			return i;
-		}
-
-		if (baseY + i >= height)
-		{
-			return i;
-		}
+	//Each page spans a range of every array of block data.
+	const size_t arrays = 4;
+	const boost::uint8_t * starts[arrays] = {
+		reinterpret_cast<const boost::uint8_t *>(portals.data()),
+		reinterpret_cast<const boost::uint8_t *>(fieldOf.data()),
+		reinterpret_cast<const boost::uint8_t *>(narrowFields.data()),
+		reinterpret_cast<const boost::uint8_t *>(wideFields.data())
+	};
 
-		//The furthest corner.
-		if (!map[index + i * width + i])
+	size_t pageCount = blockCount() ? pageOf(blockCount() - 1) + 1 : 0;
+	std::vector<std::vector<std::pair<size_t, size_t> > > spans(pageCount,
+		std::vector<std::pair<size_t, size_t> >(arrays, std::make_pair(~size_t(0), size_t(0))));
+	for (size_t b = 0; b < blockCount(); ++b)
+	{
+		const BlockRecord& record = blocks[b];
+		std::vector<std::pair<size_t, size_t> >& span = spans[pageOf(b)];
+		size_t begin[arrays] = { record.portals * sizeof(Portal), record.fieldOf * sizeof(boost::uint16_t), 0, 0 };
+		size_t end[arrays] = { (record.portals + record.portalCount) * sizeof(Portal), begin[1], 0, 0 };
+		if (record.table != NoTable)
 		{
-			return i;
+			size_t entries = Layers::Count * MaximumWidth * record.portalCount;
+			size_t fields = fieldCount(fieldOf.data() + record.fieldOf, entries, NoField) * BlockSize * BlockSize;
+			end[1] = begin[1] + entries * sizeof(boost::uint16_t);
+
+			size_t a = record.table == NarrowTable ? 2 : 3;
+			size_t element = record.table == NarrowTable ? sizeof(boost::uint8_t) : sizeof(boost::uint16_t);
+			begin[a] = record.fields * element;
+			end[a] = (record.fields + fields) * element;
 		}
 
-		//The edges.
-		for (size_t j = 0; j < i; ++j)
+		for (size_t a = 0; a < arrays; ++a)
 		{
-			if (!map[index + j * width + i])
+			if (begin[a] < end[a])
 			{
-				return i;
+				span[a].first = std::min(span[a].first, begin[a]);
+				span[a].second = std::max(span[a].second, end[a]);
 			}
+		}
+	}
 
-			if (!map[index + i * width + j])
+	std::vector<std::vector<PageRange> > ranges(pageCount);
+	for (size_t p = 0; p < pageCount; ++p)
+	{
+		for (size_t a = 0; a < arrays; ++a)
+		{
+			if (spans[p][a].first < spans[p][a].second)
 			{
-				return i;
+				PageRange range = { static_cast<size_t>(starts[a] - mapping->data()) + spans[p][a].first,
+					spans[p][a].second - spans[p][a].first };
+				ranges[p].push_back(range);
 			}
 		}
 	}
 
-	return MaximumWidth;
+	pager.reset(new Pager(*mapping, ranges, pageLimit));
 }
 
-void Map::createPortalsInBlock(Block& out, const Index& start, const Index& iterate, Direction d, size_t iterations)
+void Map::storeBlocks(const std::vector<Block>& built, const std::vector<size_t>& indices)
 {
-	for (size_t i = 0; i < iterations; ++i)
+	//Rebuilt from scratch: stored blocks are read through the old records, blocks in
+	//indices from built. The data of each page is kept together, in page order.
+	static const size_t NotBuilt = ~size_t(0);
+	std::vector<size_t> builtOf(blockCount(), NotBuilt);
+	for (size_t i = 0; i < indices.size(); ++i)
 	{
-		Index current = Index(start.x + iterate.x * i, start.y + iterate.y * i);
-		if (size_t pass = walkable(current, d))
-		{
-			if (!passable(current))
-			{
-				continue;
-			}
-
-			Portal p;
-			p.start = current;
-			p.direction = d;
-
-			bool found = false;
-			size_t maximumPortalPassability = 10;
-			for (size_t w = 1; w < iterations - i; ++w)
-			{
-				Index next = Index(current.x + iterate.x * w, current.y + iterate.y * w);
-				size_t nextPassable = std::min(passable(next), walkable(next, d));
-				if (nextPassable == 0)
-				{
-					p.size = w;
-					i += w;
-					found = true;
-					break;
-				}
+		builtOf[indices[i]] = i;
+	}
 
-				maximumPortalPassability = std::min(maximumPortalPassability, nextPassable);
-			}
+	std::vector<std::pair<size_t, size_t> > order(blockCount());
+	for (size_t b = 0; b < order.size(); ++b)
+	{
+		order[b] = std::make_pair(pageOf(b), b);
+	}
 
-			if (!found)
-			{
-				p.size = iterations - i;
-				i += iterations - i;
-			}
+	std::sort(order.begin(), order.end());
+	pager.reset();
 
-			p.passibility = maximumPortalPassability;
-			out.portals.push_back(p);
+	std::vector<BlockRecord> records(blockCount());
+	std::vector<Portal> allPortals;
+	std::vector<boost::uint16_t> allFieldOf;
+	std::vector<boost::uint8_t> allNarrow;
+	std::vector<boost::uint16_t> allWide;
 
-			GraphVertex vertex;
-			vertex.start = p;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		size_t b = order[i].second;
+		BlockView view = builtOf[b] == NotBuilt ? viewOf(b) : viewOf(built[builtOf[b]]);
+
+		BlockRecord& record = records[b];
+		record.portals = allPortals.size();
+		record.portalCount = static_cast<boost::uint32_t>(view.portalCount);
+		record.fieldOf = allFieldOf.size();
+		record.fields = 0;
+		record.table = NoTable;
+		allPortals.insert(allPortals.end(), view.portals, view.portals + view.portalCount);
+
+		if (!view.fieldOf)
+		{
+			continue;
+		}
 
-			Portal next;
-			next.start = Index(current.x + offsetX[d], current.y + offsetY[d]);
-			next.size = p.size;
-			next.direction = invert[d];
-			vertex.end = next;
+		size_t entries = Layers::Count * MaximumWidth * view.portalCount;
+		size_t fields = fieldCount(view.fieldOf, entries, NoField);
 
-			graph.push_back(vertex);
+		allFieldOf.insert(allFieldOf.end(), view.fieldOf, view.fieldOf + entries);
+		if (view.narrowFields)
+		{
+			record.table = NarrowTable;
+			record.fields = allNarrow.size();
+			allNarrow.insert(allNarrow.end(), view.narrowFields, view.narrowFields + fields * BlockSize * BlockSize);
+		}
+		else
+		{
+			record.table = WideTable;
+			record.fields = allWide.size();
+			allWide.insert(allWide.end(), view.wideFields, view.wideFields + fields * BlockSize * BlockSize);
 		}
 	}
+
+	blocks.swap(records);
+	portals.swap(allPortals);
+	fieldOf.swap(allFieldOf);
+	narrowFields.swap(allNarrow);
+	wideFields.swap(allWide);
 }
 
-void Map::simplifyBlockPortals(Block& block)
+void Map::preprocess()
 {
-	Rawr::log << "Starting portal simplification for index [" << block.index << "], Initial size: " << block.portals.size();
-	std::sort(block.portals.begin(), block.portals.end(), [this](const Portal& a, const Portal& b)
-	{
-		return a.start.index(width) < b.start.index(width);
-	});
+	Engine::Threading::WorkStealingPool pool(threadCount);
+	RAWR_LOG(Rawr::Debug) << "Preprocessing with " << pool.threadCount() << " threads";
 
-	//Remove identical portals
-	auto predicate = [](const Portal& a, const Portal& b)
+	//Clearance only reads whether tiles are free, so bands of rows are independent when written to a copy.
+	//Each layer is unpacked into a plane of its own, transformed, and packed back.
+	static const size_t BandRows = 64;
+	size_t height = map.size() / width;
+	size_t bands = (height + BandRows - 1) / BandRows;
+	std::vector<boost::uint8_t> open(map.size());
+	std::vector<boost::uint8_t> clearance(map.size());
+	std::vector<boost::uint16_t> packed(map.size(), 0);
+	for (size_t l = 0; l < Layers::Count; ++l)
 	{
-		return a.start == b.start &&
-			a.direction == b.direction &&
-			a.size == b.size;
-	};
-
-	block.portals.erase(std::unique(block.portals.begin(), block.portals.end(), predicate), block.portals.end());
+		pool.parallelFor(bands, [this, &open, l](size_t band)
+		{
+			size_t end = std::min((band + 1) * BandRows * width, map.size());
+			for (size_t i = band * BandRows * width; i < end; ++i)
+			{
+				open[i] = static_cast<boost::uint8_t>(Layers::get(map[i], l));
+			}
+		});
 
-	//Collapse portals with
-	Rawr::log << " Resulting Size: " << block.portals.size();
-}
+		pool.parallelFor(bands, [this, &open, &clearance, &packed, height, l](size_t band)
+		{
+			Pathfinder::computeClearance(&open[0], &clearance[0], width, height, band * BandRows, (band + 1) * BandRows, MaximumWidth);
 
-void Map::simplifyGraph()
-{
+			size_t end = std::min((band + 1) * BandRows * width, map.size());
+			for (size_t i = band * BandRows * width; i < end; ++i)
+			{
+				packed[i] |= clearance[i] << (l * Layers::Bits);
+			}
+		});
+	}
+	map.swap(packed);
 
-}
+	size_t count = blockCount();
+	std::vector<Block> built(count);
+	std::vector<std::vector<GraphVertex> > exits(count);
+	std::vector<std::vector<GraphVertex> > inner(count);
+	pool.parallelFor(count, [this, &built, &exits, &inner](size_t b)
+	{
+		buildBlock(b, built[b], exits[b], inner[b]);
+	});
 
-//Block pathfinding policy.
-struct BlockFindPolicy : public Pathfinder::PathfindPolicy<BlockFindPolicy>
-{
-	typedef Index Element;
-	typedef size_t Hash;
+	std::vector<size_t> all(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		all[i] = i;
+	}
 
-	BlockFindPolicy(const Index& start, const Index& end, size_t blockIndex, size_t width, size_t size, const Map * map)
-		:start(start)
-		,end(end)
-		,blockIndex(blockIndex)
-		,width(width)
-		,size(size)
-		,map(map)
-	{}
+	blocks.clear();
+	storeBlocks(built, all);
 
-	size_t startingCount()
+	//Merged in block order, so the graph does not depend on the thread count.
+	std::vector<GraphVertex> edges;
+	for (size_t i = 0; i < count; ++i)
 	{
-		return 1;
+		edges.insert(edges.end(), exits[i].begin(), exits[i].end());
 	}
 
-	const Index& startingPoint(size_t)
+	for (size_t i = 0; i < count; ++i)
 	{
-		return start;
+		edges.insert(edges.end(), inner[i].begin(), inner[i].end());
 	}
 
-	bool finished(const Index& s)
+	RAWR_LOG(Rawr::Debug) << "Graph: " << edges.size() << " edges";
+
+	PortalTableStats tables = portalTableStats();
+	RAWR_LOG(Rawr::Debug) << "Portal tables: " << tables.bytes << " bytes in " << tables.tabledBlocks << " blocks, "
+		<< tables.searchedBlocks << " blocks search";
+
+	simplifyGraph();
+	buildAdjacency(edges);
+
+	for (size_t k = 1; k < levelCount; ++k)
 	{
-		return s == end;
+		buildLevel(k, pool);
 	}
 
-	Hash hash(const Index& ind)
+	for (size_t k = 0; k < levels.size(); ++k)
 	{
-		return ind.index(width);
+		RAWR_LOG(Rawr::Debug) << "Level " << k << ": " << levels[k].clusterNodes.size() << " nodes, "
+			<< levels[k].edges.size() << " edges, clusters of " << levels[k].clusterSize << " tiles";
 	}
+}
 
-	size_t predict(const Index& s)
+Index Map::nodeIndex(boost::uint32_t node) const
+{
+	return Index::fromIndex(nodeTiles[node], width);
+}
+
+boost::uint32_t Map::nodeId(const Index& ind) const
+{
+	boost::uint32_t tile = static_cast<boost::uint32_t>(ind.index(width));
+	const boost::uint32_t * it = std::lower_bound(nodeTiles.begin(), nodeTiles.end(), tile);
+	if (it == nodeTiles.end() || *it != tile)
 	{
-		int diffx = static_cast<int>(s.x) - static_cast<int>(end.x);
-		int diffy = static_cast<int>(s.y) - static_cast<int>(end.y);
-		int diffz = static_cast<int>(s.z) - static_cast<int>(end.z);
-		return diffx * diffx + diffy * diffy + diffz * diffz;
+		return NoNode;
 	}
 
-	size_t neighborCount(const Index& elem)
+	return static_cast<boost::uint32_t>(it - nodeTiles.begin());
+}
+
+//Flattens the vertices into compressed sparse row form, as level 0.
+void Map::buildAdjacency(const std::vector<GraphVertex>& vertices)
+{
+	std::vector<boost::uint32_t> tiles;
+	tiles.reserve(vertices.size() * 2);
+	for (size_t i = 0; i < vertices.size(); ++i)
 	{
-		return 8;
+		tiles.push_back(static_cast<boost::uint32_t>(vertices[i].start.start.index(width)));
+		tiles.push_back(static_cast<boost::uint32_t>(vertices[i].end.start.index(width)));
 	}
 
-	Index neighbor(const Index& elem, size_t i)
+	std::sort(tiles.begin(), tiles.end());
+	tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+	nodeTiles.swap(tiles);
+
+	std::vector<PendingEdge> pending(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
 	{
-		Direction possible[8] = {
-			SOUTHWEST, SOUTH, SOUTHEAST, WEST, EAST, NORTHWEST, NORTH, NORTHEAST
-		};
+		pending[i].source = nodeId(vertices[i].start.start);
+		pending[i].edge.target = nodeId(vertices[i].end.start);
+		pending[i].edge.length = static_cast<boost::uint32_t>(vertices[i].length);
+		pending[i].edge.clearance = vertices[i].clearance;
+	}
+
+	levels.assign(1, AbstractLevel());
+	levels[0].clusterSize = BlockSize;
+	flattenEdges(pending, nodeTiles.size(), levels[0]);
+	groupClusters(levels[0], std::vector<bool>(nodeTiles.size(), true));
+}
+
+//Builds a level from the one below. Edges leaving a cluster carry over unchanged and their
+//endpoints become the nodes of the level. Nodes sharing a cluster are linked by the shortest
+//paths between them on the level below, one edge per distinct length across unit sizes.
+//When rebuilding after a terrain update, clusters without dirty blocks keep the inner edges
+//of the previous build, with node ids translated through remap. Returns the clusters searched.
+size_t Map::buildLevel(size_t k, Engine::Threading::WorkStealingPool& pool, const AbstractLevel * previous, const std::vector<boost::uint32_t> * remap, const std::vector<bool> * dirtyBlocks)
+{
+	size_t clustersBuilt = 0;
+	size_t nodes = nodeTiles.size();
+
+	levels.push_back(AbstractLevel());
+	levels[k].clusterSize = levels[k - 1].clusterSize * ClusterBlocks;
+	const AbstractLevel& below = levels[k - 1];
 
-		return Index(elem.x + offsetX[possible[i]], elem.y + offsetY[possible[i]]);
+	std::vector<PendingEdge> pending;
+	std::vector<bool> member(nodes, false);
+	for (boost::uint32_t n = 0; n < nodes; ++n)
+	{
+		size_t cluster = clusterOf(nodeIndex(n), k);
+		for (size_t e = below.offsets[n]; e < below.offsets[n + 1]; ++e)
+		{
+			if (clusterOf(nodeIndex(below.edges[e].target), k) != cluster)
+			{
+				PendingEdge p = { n, below.edges[e] };
+				pending.push_back(p);
+				member[n] = true;
+				member[below.edges[e].target] = true;
+			}
+		}
 	}
 
-	bool passable(const Index& elem)
+	groupClusters(levels[k], member);
+
+	std::vector<bool> dirty(levels[k].clusterOffsets.size() - 1, true);
+	if (previous)
 	{
-		size_t w = map->passable(elem);
-		if (w < size)
+		std::fill(dirty.begin(), dirty.end(), false);
+		for (size_t b = 0; b < dirtyBlocks->size(); ++b)
 		{
-			return false;
+			if ((*dirtyBlocks)[b])
+			{
+				dirty[clusterOf(blockOrigin(b), k)] = true;
+			}
 		}
+	}
 
-		if (map->blockIndex(elem) != blockIndex)
+	const Engine::Memory::SharedArray<boost::uint32_t>& clusterOffsets = levels[k].clusterOffsets;
+	const Engine::Memory::SharedArray<boost::uint32_t>& clusterNodes = levels[k].clusterNodes;
+	//Clusters only read the level below, so each fills its own edge list and the lists are
+	//merged in cluster order afterwards.
+	std::vector<std::vector<PendingEdge> > clusterEdges(dirty.size());
+	pool.parallelFor(dirty.size(), [&](size_t c)
+	{
+		std::vector<PendingEdge>& pending = clusterEdges[c];
+		size_t first = clusterOffsets[c];
+		size_t count = clusterOffsets[c + 1] - first;
+
+		if (!dirty[c])
 		{
-			return false;
+			for (size_t i = previous->clusterOffsets[c]; i < previous->clusterOffsets[c + 1]; ++i)
+			{
+				boost::uint32_t a = previous->clusterNodes[i];
+				assert((*remap)[a] != NoNode);
+				for (size_t e = previous->offsets[a]; e < previous->offsets[a + 1]; ++e)
+				{
+					if (clusterOf(nodeIndex((*remap)[previous->edges[e].target]), k) == c)
+					{
+						PendingEdge p = { (*remap)[a], previous->edges[e] };
+						p.edge.target = (*remap)[previous->edges[e].target];
+						pending.push_back(p);
+					}
+				}
+			}
+
+			return;
 		}
 
-		return true;
-	}
+		Scratch::GraphWorkspace& workspace = scratch().graphWorkspace(nodes + 1);
+		Engine::Memory::StackScope scope(&scratch().allocator);
+		NodeLinks start(1, NodeLink(), arena());
+		std::vector<size_t> lengths;
+		std::vector<size_t> pair(Layers::Count * MaximumWidth);
+		std::vector<std::pair<size_t, boost::uint16_t> > packed;
 
-	Index start;
-	Index end;
+		//Layers with the same clearance on every tile of the cluster get the same paths.
+		size_t clusterSize = levels[k].clusterSize;
+		size_t across = (width + clusterSize - 1) / clusterSize;
+		size_t same[Layers::Count];
+		equalLayers(Index((c % across) * clusterSize, (c / across) * clusterSize), clusterSize, same);
 
-	size_t blockIndex;
-	size_t width;
-	size_t size;
-	const Map * map;
-};
+		for (size_t i = 0; i < count; ++i)
+		{
+			boost::uint32_t a = clusterNodes[first + i];
 
-/*
-struct PortalPathfindPolicy : public Pathfinder::PathfindPolicy<PortalPathfindPolicy>
-{
-	typedef Portal Element;
-	typedef size_t Hash;
+			//lengths[((l * MaximumWidth) + s - 1) * count + j] is the distance to node j for units of size s in layer l.
+			lengths.assign(Layers::Count * MaximumWidth * count, Pathfinder::NoPath);
+			start[0].node = a;
+			start[0].length = 0;
+			for (size_t l = 0; l < Layers::Count; ++l)
+			{
+				size_t row = l * MaximumWidth * count;
+				if (same[l] != l)
+				{
+					std::copy(lengths.begin() + same[l] * MaximumWidth * count, lengths.begin() + (same[l] + 1) * MaximumWidth * count,
+						lengths.begin() + row);
+					continue;
+				}
 
-	BlockFindPolicy(const std::vector<Portal>& start, const std::vector<Portal>& end, size_t width, const Map * map)
-		:start(start)
-		,end(end)
-		,width(width)
-		,map(map)
-	{}
+				size_t widest = passable(nodeIndex(a), l);
+				for (size_t s = 1; s <= widest; ++s)
+				{
+					settleLevel(k - 1, c, start, s, l);
+					for (size_t j = 0; j < count; ++j)
+					{
+						lengths[row + (s - 1) * count + j] = workspace.settled(clusterNodes[first + j]);
+					}
+				}
+			}
 
-	size_t startingCount()
-	{
-		return start.size();
-	}
+			for (size_t j = 0; j < count; ++j)
+			{
+				if (i == j)
+				{
+					continue;
+				}
 
-	const Index& startingPoint(size_t i)
-	{
-		return start[i];
-	}
+				for (size_t l = 0; l < pair.size(); ++l)
+				{
+					pair[l] = lengths[l * count + j];
+				}
 
-	bool finished(const Portal& s)
-	{
-		return std::find(end.begin(), end.end(), s) != end.end();
-	}
+				packLengths(pair, MaximumWidth, packed);
+				for (size_t e = 0; e < packed.size(); ++e)
+				{
+					PendingEdge p = PendingEdge();
+					p.source = a;
+					p.edge.target = clusterNodes[first + j];
+					p.edge.length = static_cast<boost::uint32_t>(packed[e].first);
+					p.edge.clearance = packed[e].second;
+					pending.push_back(p);
+				}
+			}
+		}
+	});
 
-	Hash hash(const Portal& ind)
+	for (size_t c = 0; c < dirty.size(); ++c)
 	{
-		return ind.start.index(width);
+		clustersBuilt += dirty[c];
+		pending.insert(pending.end(), clusterEdges[c].begin(), clusterEdges[c].end());
 	}
 
-	size_t score(const Index& s, const Index& e)
+	flattenEdges(pending, nodes, levels[k]);
+	return clustersBuilt;
+}
+
+Index Map::blockOrigin(size_t bi) const
+{
+	size_t blockWidth = width / BlockSize;
+	return Index((bi % blockWidth) * BlockSize, (bi / blockWidth) * BlockSize);
+}
+
+UpdateStats Map::updateTiles(const TileRegion& region, const std::vector<boost::uint8_t>& values)
+{
+	UpdateStats stats = { 0, 0, 0, 0, 0 };
+
+	size_t height = map.size() / width;
+	size_t x0 = region.origin.x;
+	size_t y0 = region.origin.y;
+	size_t x1 = std::min(x0 + region.width, width);
+	size_t y1 = std::min(y0 + region.height, height);
+	if (x0 >= x1 || y0 >= y1)
 	{
-		int diffx = static_cast<int>(s.x) - static_cast<int>(e.x);
-		int diffy = static_cast<int>(s.y) - static_cast<int>(e.y);
-		int diffz = static_cast<int>(s.z) - static_cast<int>(e.z);
-		return diffx * diffx + diffy * diffy + diffz * diffz;
+		return stats;
 	}
 
-	size_t predict(const Index& s)
+	//A mapped map is copied on the first change.
+	std::vector<boost::uint16_t>& tiles = map.edit();
+	for (size_t y = y0; y < y1; ++y)
 	{
-		size_t best = score(s, end[0]);
-
-		for (size_t i = 1; i < end.size(); ++i)
+		for (size_t x = x0; x < x1; ++x)
 		{
-			best = std::min(best, score(s, end[i]));
+			tiles[x + y * width] = Layers::fill(values[(x - x0) + (y - y0) * region.width], MaximumWidth);
 		}
-
-		return best;
 	}
 
-	size_t neighborCount(const Portal& elem)
+	//Clearance looks right and down, so only tiles up and left of the region can change. Those
+	//are recomputed from a window reaching far enough right and down to see every tile they depend on.
+	size_t cx0 = x0 > MaximumWidth - 1 ? x0 - (MaximumWidth - 1) : 0;
+	size_t cy0 = y0 > MaximumWidth - 1 ? y0 - (MaximumWidth - 1) : 0;
+	size_t wx1 = std::min(x1 + MaximumWidth - 1, width);
+	size_t wy1 = std::min(y1 + MaximumWidth - 1, height);
+	size_t windowWidth = wx1 - cx0;
+	size_t windowHeight = wy1 - cy0;
+
+	std::vector<boost::uint8_t> open(windowWidth * windowHeight);
+	std::vector<boost::uint8_t> clearance(windowWidth * windowHeight);
+	for (size_t l = 0; l < Layers::Count; ++l)
 	{
+		for (size_t y = cy0; y < wy1; ++y)
+		{
+			for (size_t x = cx0; x < wx1; ++x)
+			{
+				open[(x - cx0) + (y - cy0) * windowWidth] = static_cast<boost::uint8_t>(Layers::get(map[x + y * width], l));
+			}
+		}
 
+		Pathfinder::computeClearance(&open[0], &clearance[0], windowWidth, windowHeight, 0, y1 - cy0, MaximumWidth);
+
+		boost::uint16_t keep = ~(Layers::FieldMask << (l * Layers::Bits));
+		for (size_t y = cy0; y < y1; ++y)
+		{
+			for (size_t x = cx0; x < x1; ++x)
+			{
+				boost::uint16_t& t = tiles[x + y * width];
+				t = (t & keep) | (clearance[(x - cx0) + (y - cy0) * windowWidth] << (l * Layers::Bits));
+			}
+		}
 	}
 
-	Index neighbor(const Index& elem, size_t i)
-	{
-		Direction possible[8] = {
-			SOUTHWEST, SOUTH, SOUTHEAST, WEST, EAST, NORTHWEST, NORTH, NORTHEAST
-		};
+	stats.tilesRecomputed = (x1 - cx0) * (y1 - cy0);
 
-		return Index(elem.x + offsetX[possible[i]], elem.y + offsetY[possible[i]]);
+	//Portals read the tiles across the border, so blocks one tile away are dirty too.
+	std::vector<bool> dirty(blockCount(), false);
+	size_t bx0 = (cx0 > 0 ? cx0 - 1 : 0) / BlockSize;
+	size_t by0 = (cy0 > 0 ? cy0 - 1 : 0) / BlockSize;
+	size_t bx1 = std::min(x1, width - 1) / BlockSize;
+	size_t by1 = std::min(y1, height - 1) / BlockSize;
+	for (size_t by = by0; by <= by1; ++by)
+	{
+		for (size_t bx = bx0; bx <= bx1; ++bx)
+		{
+			dirty[bx + by * (width / BlockSize)] = true;
+			++stats.blocksRebuilt;
+		}
 	}
 
-	bool passable(const Index& elem)
+	//Only level 0 is kept of the vertices, so those of clean blocks are read back from it.
+	const AbstractLevel& bottom = levels[0];
+	std::vector<GraphVertex> edges;
+	edges.reserve(bottom.edges.size());
+	for (boost::uint32_t n = 0; n + 1 < bottom.offsets.size(); ++n)
 	{
-		size_t w = map->passable(elem);
-		if (w < size)
+		Index from = nodeIndex(n);
+		if (dirty[blockIndex(from)])
 		{
-			return false;
+			stats.edgesRemoved += bottom.offsets[n + 1] - bottom.offsets[n];
+			continue;
 		}
 
-		if (map->blockIndex(elem) != blockIndex)
+		for (size_t e = bottom.offsets[n]; e < bottom.offsets[n + 1]; ++e)
 		{
-			return false;
+			GraphVertex v;
+			v.start.start = from;
+			v.end.start = nodeIndex(bottom.edges[e].target);
+			v.length = bottom.edges[e].length;
+			v.clearance = bottom.edges[e].clearance;
+			edges.push_back(v);
 		}
+	}
+	routes->invalidate(dirty);
 
-		return true;
+	std::vector<size_t> rebuilt;
+	for (size_t b = 0; b < dirty.size(); ++b)
+	{
+		if (dirty[b])
+		{
+			rebuilt.push_back(b);
+		}
 	}
 
-	const std::vector<Portal>& start;
-	const std::vector<Portal>& end;
+	Engine::Threading::WorkStealingPool pool(threadCount);
+	std::vector<Block> built(rebuilt.size());
+	std::vector<std::vector<GraphVertex> > exits(rebuilt.size());
+	std::vector<std::vector<GraphVertex> > inner(rebuilt.size());
+	pool.parallelFor(rebuilt.size(), [this, &rebuilt, &built, &exits, &inner](size_t i)
+	{
+		buildBlock(rebuilt[i], built[i], exits[i], inner[i]);
+	});
+	storeBlocks(built, rebuilt);
 
-	size_t width;
-	const Map * map;
-};
-*/
+	size_t before = edges.size();
+	for (size_t i = 0; i < rebuilt.size(); ++i)
+	{
+		edges.insert(edges.end(), exits[i].begin(), exits[i].end());
+		edges.insert(edges.end(), inner[i].begin(), inner[i].end());
+	}
+	stats.edgesAdded = edges.size() - before;
 
-//This finds a path completely within a single block.
-//Generally used to create a path between portals or between a point and another portal.
-size_t Map::blockpathfind(size_t bi, const Index& start, const Index& end, size_t size, std::vector<Index> * foundPath) const
-{
-	BlockFindPolicy policy(start, end, bi, width, size, this);
-	return Pathfinder::pathfind(policy, foundPath);
-}
+	std::vector<boost::uint32_t> oldTiles(nodeTiles.begin(), nodeTiles.end());
+	std::vector<AbstractLevel> old;
+	old.swap(levels);
 
+	buildAdjacency(edges);
 
-//This finds a path between two sets of portals.
-//TODO: Passability and size.
-size_t Map::portalPathfind(const std::vector<Portal>& origins, const std::vector<Portal>& goals) const
-{
-	std::vector<Portal> open = origins;
-	std::vector<Portal> closed;
+	std::vector<boost::uint32_t> remap(oldTiles.size());
+	for (size_t i = 0; i < oldTiles.size(); ++i)
+	{
+		remap[i] = nodeId(Index::fromIndex(oldTiles[i], width));
+	}
 
-	while (!open.empty())
+	for (size_t k = 1; k < old.size(); ++k)
 	{
-		Portal target = open.back();
-		open.pop_back();
+		stats.clustersRebuilt += buildLevel(k, pool, &old[k], &remap, &dirty);
+	}
 
-		if (std::find(goals.begin(), goals.end(), target) != goals.end())
-		{
-			return 1;
-		}
+	return stats;
+}
 
-		closed.push_back(target);
+void Map::groupClusters(AbstractLevel& level, const std::vector<bool>& member) const
+{
+	size_t height = map.size() / width;
+	size_t across = (width + level.clusterSize - 1) / level.clusterSize;
+	size_t down = (height + level.clusterSize - 1) / level.clusterSize;
 
-		std::vector<Portal> possible;
-		for (size_t i = 0; i < graph.size(); ++i)
+	std::vector<std::pair<size_t, boost::uint32_t> > sorted;
+	for (boost::uint32_t n = 0; n < member.size(); ++n)
+	{
+		if (member[n])
 		{
-			if (graph[i].start.start == target.start)
-			{
-				possible.push_back(graph[i].end);
-			}
+			Index at = nodeIndex(n);
+			size_t cluster = at.x / level.clusterSize + (at.y / level.clusterSize) * across;
+			sorted.push_back(std::make_pair(cluster, n));
 		}
+	}
 
-		for (size_t i = 0; i < possible.size(); ++i)
-		{
-			bool found = false;
-			for (size_t j = 0; j < closed.size(); ++j)
-			{
-				if (possible[i].start == closed[j].start)
-				{
-					found = true;
-					break;
-				}
-			}
+	std::sort(sorted.begin(), sorted.end());
 
-			if (!found)
-			{
-				open.push_back(possible[i]);
-			}
-		}
+	std::vector<boost::uint32_t> offsets(across * down + 1, 0);
+	std::vector<boost::uint32_t> nodes(sorted.size());
+	for (size_t i = 0; i < sorted.size(); ++i)
+	{
+		nodes[i] = sorted[i].second;
+		++offsets[sorted[i].first + 1];
 	}
 
-	return 0;
+	for (size_t i = 1; i < offsets.size(); ++i)
+	{
+		offsets[i] += offsets[i - 1];
+	}
+
+	level.clusterOffsets.swap(offsets);
+	level.clusterNodes.swap(nodes);
 }
 
-//Generates all the portal links within a single block.
-void Map::innerblockPathfind(const Block& block)
+size_t Map::clusterOf(const Index& ind, size_t level) const
 {
-	//Uniform cost for moving, moving diagonally costs 1.5 movement.
-	for (size_t i = 0; i < block.portals.size(); ++i)
-	{
-		for (size_t j = 0; j < block.portals.size(); ++j)
-		{
-			if (i != j)
-			{
-				size_t pathLength = blockpathfind(block.index, block.portals[i].start, block.portals[j].start, 1, nullptr);
-				if (pathLength > 0)
-				{
-					GraphVertex vert;
-					vert.start = block.portals[i];
-					vert.end = block.portals[j];
-					vert.length = pathLength;
-					graph.push_back(vert);
-				}
-			}
-		}
-	}
+	size_t clusterSize = levels[level].clusterSize;
+	size_t across = (width + clusterSize - 1) / clusterSize;
+	return ind.x / clusterSize + (ind.y / clusterSize) * across;
 }
 
-std::vector<Portal> Map::linkPositionAndPortals(const Index& ind, size_t size) const
+void Map::setBlockSearch(BlockSearch method)
 {
-	size_t bi = blockIndex(ind);
-	const Block& block = blocks[bi];
+	searchMethod = method;
+}
+
+BlockSearch Map::blockSearch() const
+{
+	return searchMethod;
+}
 
-	std::vector<Portal> result;
-	for (size_t i = 0; i < block.portals.size(); ++i)
+size_t Map::blockPath(const Index& start, const Index& end, size_t size, boost::uint8_t capabilities,
+	std::vector<Index> * path, size_t * expanded) const
+{
+	StatsRecorder recorder(*this);
+	std::vector<Index> walked;
+	if (!path)
 	{
-		size_t path = blockpathfind(bi, ind, block.portals[i].start, size, nullptr);
-		if (path != 0)
-		{
-			result.push_back(block.portals[i]);
-		}
+		path = &walked;
 	}
 
-	return result;
+	size_t layer = Layers::forCapabilities(capabilities);
+	size_t bi = blockIndex(start);
+	if (layer == Layers::None || bi != blockIndex(end))
+	{
+		path->clear();
+		return Pathfinder::NoPath;
+	}
+
+	return blockpathfind(bi, start, end, size, layer, path, expanded);
 }
 
-void Map::createBlockData(size_t bi)
+void Map::setLevels(size_t count)
 {
-	size_t blockWidth = width / BlockSize;
-	size_t startX = (bi % blockWidth) * BlockSize;
-	size_t startY = (bi / blockWidth) * BlockSize;
+	levelCount = std::max<size_t>(count, 1);
+}
 
-	//For this block, compute the exits.
-	//Compute exits for the given border, going in the border direction.
-	Block block;
-	block.index = bi;
-	createPortalsInBlock(block, Index(startX, startY), Index(1, 0), NORTH, BlockSize);
-	createPortalsInBlock(block, Index(startX, startY), Index(0, 1), WEST, BlockSize);
-	createPortalsInBlock(block, Index(startX, startY + BlockSize - 1), Index(1, 0), SOUTH, BlockSize);
-	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY), Index(0, 1), EAST, BlockSize);
+void Map::setThreads(size_t threads)
+{
+	threadCount = threads;
+}
 
-	//Compute exits for the corners.
-	createPortalsInBlock(block, Index(startX, startY), Index(1, 0), NORTHWEST, 1);
-	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY), Index(1, 0), NORTHEAST, 1);
-	createPortalsInBlock(block, Index(startX, startY + BlockSize - 1), Index(1, 0), SOUTHWEST, BlockSize);
-	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY + BlockSize - 1), Index(1, 0), SOUTHEAST, BlockSize);
+size_t Map::threads() const
+{
+	return threadCount;
+}
 
-	//Compute exits for all up/down transitions.
-	createPortalsInBlock(block, Index(startX+1, startY), Index(1, 0), NORTHWEST, BlockSize - 1);
-	createPortalsInBlock(block, Index(startX, startY), Index(1, 0), NORTHEAST, BlockSize - 1);
+void Map::setPortalTableLimit(size_t bytes)
+{
+	tableLimit = bytes;
+}
 
-	createPortalsInBlock(block, Index(startX, startY+1), Index(0, 1), NORTHWEST, BlockSize - 1);
-	createPortalsInBlock(block, Index(startX, startY), Index(0, 1), SOUTHWEST, BlockSize - 1);
+void Map::setRouteCacheCapacity(size_t entries)
+{
+	routes->setCapacity(entries);
+}
 
-	createPortalsInBlock(block, Index(startX+1, startY + BlockSize - 1), Index(1, 0), SOUTHWEST, BlockSize - 1);
-	createPortalsInBlock(block, Index(startX, startY + BlockSize - 1), Index(1, 0), SOUTHEAST, BlockSize - 1);
+RouteCacheStats Map::routeCacheStats() const
+{
+	return routes->stats();
+}
 
-	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY+1), Index(0, 1), NORTHEAST, BlockSize - 1);
-	createPortalsInBlock(block, Index(startX + BlockSize - 1, startY), Index(0, 1), SOUTHEAST, BlockSize - 1);
+Pathfinder::QueryStatsTotals Map::queryStats() const
+{
+	std::lock_guard<std::mutex> hold(statsLock);
+	return statsTotals;
+}
 
-	//Inner-block path computation and vertex emittal.
-	blocks.push_back(block);
+void Map::resetQueryStats()
+{
+	std::lock_guard<std::mutex> hold(statsLock);
+	statsTotals = Pathfinder::QueryStatsTotals();
 }
 
-void Map::preprocess()
+void Map::setPageBudget(size_t bytes)
 {
-	for (size_t i = 0; i < map.size(); ++i)
+	pageLimit = bytes;
+	if (pager && bytes > 0)
 	{
-		map[i] = maximumPassibility(i);
+		pager->setBudget(bytes);
 	}
+	else
+	{
+		startPaging();
+	}
+}
 
-	for (size_t i = 0; i < map.size() / (BlockSize * BlockSize); ++i)
+PageStats Map::pageStats() const
+{
+	if (!pager)
 	{
-		createBlockData(i);
+		PageStats none = { 0, 0, 0, 0, 0 };
+		return none;
 	}
 
+	return pager->stats();
+}
+
+PortalTableStats Map::portalTableStats() const
+{
+	PortalTableStats stats = { 0, 0, 0 };
 	for (size_t i = 0; i < blocks.size(); ++i)
 	{
-		simplifyBlockPortals(blocks[i]);
+		if (blocks[i].table == NoTable)
+		{
+			++stats.searchedBlocks;
+		}
+		else
+		{
+			++stats.tabledBlocks;
+		}
 	}
 
-	for (size_t i = 0; i < blocks.size(); ++i)
+	stats.bytes = fieldOf.size() * sizeof(boost::uint16_t) + narrowFields.size() + wideFields.size() * sizeof(boost::uint16_t);
+	return stats;
+}
+
+namespace
+{
+	template<typename T>
+	size_t bytesOf(const Engine::Memory::SharedArray<T>& array)
 	{
-		innerblockPathfind(blocks[i]);
+		return array.size() * sizeof(T);
+	}
+}
+
+size_t Map::memoryUsage() const
+{
+	size_t bytes = bytesOf(map) + bytesOf(blocks) + bytesOf(portals) + bytesOf(fieldOf) + bytesOf(narrowFields) +
+		bytesOf(wideFields) + bytesOf(nodeTiles);
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		bytes += bytesOf(levels[i].offsets) + bytesOf(levels[i].edges) + bytesOf(levels[i].clusterOffsets) +
+			bytesOf(levels[i].clusterNodes);
 	}
 
-	std::cout << "Graph: " << graph.size() << "\n";
+	return bytes;
+}
 
-	simplifyGraph();
+std::vector<LevelStats> Map::levelStats() const
+{
+	std::vector<LevelStats> result;
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		LevelStats stats = { levels[i].clusterSize, levels[i].clusterNodes.size(), levels[i].edges.size() };
+		result.push_back(stats);
+	}
+
+	return result;
 }
 
 void Map::debugDisplay(const OriginAndGoal& goal) const
@@ -658,13 +3386,22 @@ void Map::debugDisplay(const OriginAndGoal& goal) const
 		{
 			std::cout << "\033[38;5;2m" << "S";
 		}
-		else if (map[i] == MaximumWidth)
+		else if (Layers::get(map[i], Layers::Ground) == MaximumWidth)
 		{
 			std::cout << "\033[38;5;241m" << ".";
+		}
+		else if (Layers::get(map[i], Layers::Ground) == 0 && Layers::get(map[i], Layers::Water))
+		{
+			std::cout << "\033[38;5;4m" << "~";
+		}
+		else if (Layers::get(map[i], Layers::Ground) == 0 && Layers::get(map[i], Layers::Air))
+		{
+			std::cout << "\033[38;5;5m" << "^";
 		} else
 		{
-			std::cout << "\033[38;5;" << colors[map[i]] << "m";
-			std::cout << (int)map[i];
+			size_t ground = Layers::get(map[i], Layers::Ground);
+			std::cout << "\033[38;5;" << colors[ground] << "m";
+			std::cout << ground;
 		}
 	}
 
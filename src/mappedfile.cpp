@@ -0,0 +1,121 @@
+#include "mappedfile.h"
+
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+namespace Engine
+{
+	namespace Memory
+	{
+		MappedFile::MappedFile()
+			:bytes(nullptr)
+			,length(0)
+		{}
+
+		MappedFile::~MappedFile()
+		{
+			close();
+		}
+
+		bool MappedFile::open(const char * path)
+		{
+			close();
+
+#ifdef HAVE_MMAP
+			int file = ::open(path, O_RDONLY);
+			if (file < 0)
+			{
+				return false;
+			}
+
+			struct stat info;
+			if (fstat(file, &info) != 0 || info.st_size <= 0)
+			{
+				::close(file);
+				return false;
+			}
+
+			void * mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, file, 0);
+			::close(file);
+			if (mapped == MAP_FAILED)
+			{
+				return false;
+			}
+
+			bytes = static_cast<const boost::uint8_t *>(mapped);
+			length = static_cast<size_t>(info.st_size);
+#else
+			std::ifstream input(path, std::ios::binary);
+			copy.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+			if (copy.empty())
+			{
+				return false;
+			}
+
+			bytes = &copy[0];
+			length = copy.size();
+#endif
+			return true;
+		}
+
+		void MappedFile::close()
+		{
+#ifdef HAVE_MMAP
+			if (bytes)
+			{
+				munmap(const_cast<boost::uint8_t *>(bytes), length);
+			}
+#endif
+			copy.clear();
+			bytes = nullptr;
+			length = 0;
+		}
+
+		const boost::uint8_t * MappedFile::data() const
+		{
+			return bytes;
+		}
+
+		size_t MappedFile::size() const
+		{
+			return length;
+		}
+
+		void MappedFile::willNeed(size_t offset, size_t count) const
+		{
+#ifdef HAVE_MMAP
+			size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			size_t begin = offset / page * page;
+			size_t end = std::min(offset + count, length);
+			if (bytes && begin < end)
+			{
+				madvise(const_cast<boost::uint8_t *>(bytes) + begin, end - begin, MADV_WILLNEED);
+			}
+#endif
+		}
+
+		void MappedFile::release(size_t offset, size_t count) const
+		{
+#ifdef HAVE_MMAP
+			//Pages shared with the neighbouring ranges are kept.
+			size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			size_t begin = (offset + page - 1) / page * page;
+			size_t end = std::min(offset + count, length) / page * page;
+			if (bytes && begin < end)
+			{
+				madvise(const_cast<boost::uint8_t *>(bytes) + begin, end - begin, MADV_DONTNEED);
+			}
+#endif
+		}
+	}
+}
@@ -0,0 +1,111 @@
+#include "pager.h"
+
+#include <algorithm>
+
+Pager::Pager(const Engine::Memory::MappedFile& file, const std::vector<std::vector<PageRange> >& pageRanges, size_t budget)
+	:file(file)
+	,pages(new Page[pageRanges.size()])
+	,pageCount(pageRanges.size())
+	,clock(1)
+	,limit(budget)
+	,residentBytes(0)
+	,residentPages(0)
+	,loads(0)
+	,evictions(0)
+{
+	for (size_t p = 0; p < pageCount; ++p)
+	{
+		Page& page = pages[p];
+		page.lastUse.store(0, std::memory_order_relaxed);
+		page.resident.store(false, std::memory_order_relaxed);
+		page.bytes = 0;
+		page.firstRange = ranges.size();
+		page.rangeCount = pageRanges[p].size();
+		for (size_t r = 0; r < pageRanges[p].size(); ++r)
+		{
+			page.bytes += pageRanges[p][r].length;
+			ranges.push_back(pageRanges[p][r]);
+		}
+	}
+
+	//Nothing counts as resident before it is used, whatever reading the file brought in.
+	for (size_t r = 0; r < ranges.size(); ++r)
+	{
+		file.release(ranges[r].offset, ranges[r].length);
+	}
+}
+
+void Pager::setBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	limit = bytes;
+	evictTo(limit, pageCount);
+}
+
+PageStats Pager::stats() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	PageStats result = { pageCount, residentPages, residentBytes, loads, evictions };
+	return result;
+}
+
+void Pager::admit(size_t page)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	Page& p = pages[page];
+	if (p.resident.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+
+	//Pages used since the last admission count as equally recent.
+	p.lastUse.store(clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	p.resident.store(true, std::memory_order_release);
+	residentBytes += p.bytes;
+	++residentPages;
+	++loads;
+
+	for (size_t r = p.firstRange; r < p.firstRange + p.rangeCount; ++r)
+	{
+		file.willNeed(ranges[r].offset, ranges[r].length);
+	}
+
+	//Evicts down to 7/8 of the budget, so the scan runs once per several admissions.
+	if (residentBytes > limit)
+	{
+		evictTo(limit - limit / 8, page);
+	}
+}
+
+void Pager::evictTo(size_t target, size_t keep)
+{
+	if (residentBytes <= target)
+	{
+		return;
+	}
+
+	std::vector<std::pair<boost::uint64_t, size_t> > resident;
+	resident.reserve(residentPages);
+	for (size_t p = 0; p < pageCount; ++p)
+	{
+		if (p != keep && pages[p].resident.load(std::memory_order_relaxed))
+		{
+			resident.push_back(std::make_pair(pages[p].lastUse.load(std::memory_order_relaxed), p));
+		}
+	}
+
+	std::sort(resident.begin(), resident.end());
+	for (size_t i = 0; i < resident.size() && residentBytes > target; ++i)
+	{
+		Page& p = pages[resident[i].second];
+		p.resident.store(false, std::memory_order_release);
+		residentBytes -= p.bytes;
+		--residentPages;
+		++evictions;
+
+		for (size_t r = p.firstRange; r < p.firstRange + p.rangeCount; ++r)
+		{
+			file.release(ranges[r].offset, ranges[r].length);
+		}
+	}
+}
@@ -0,0 +1,138 @@
+#include "routecache.h"
+
+#include <algorithm>
+
+bool RouteKey::operator==(const RouteKey& other) const
+{
+	return originBlock == other.originBlock && goalBlock == other.goalBlock &&
+		size == other.size && layer == other.layer;
+}
+
+size_t RouteCache::KeyHash::operator()(const RouteKey& key) const
+{
+	size_t h = key.originBlock;
+	h = h * 31 + key.goalBlock;
+	h = h * 31 + key.size;
+	h = h * 31 + key.layer;
+	return h;
+}
+
+RouteCache::RouteCache(size_t capacity)
+	:limit(capacity)
+	,hits(0)
+	,misses(0)
+	,invalidated(0)
+{}
+
+void RouteCache::setCapacity(size_t capacity)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	limit = capacity;
+	while (entries.size() > limit)
+	{
+		index.erase(entries.back().first);
+		entries.pop_back();
+	}
+}
+
+size_t RouteCache::capacity() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return limit;
+}
+
+bool RouteCache::find(const RouteKey& key, RoutePortals& portals, size_t& length)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	Lookup::iterator found = index.find(key);
+	if (found == index.end())
+	{
+		++misses;
+		return false;
+	}
+
+	entries.splice(entries.begin(), entries, found->second);
+	const CachedRoute& route = found->second->second;
+	portals.assign(route.portals.begin(), route.portals.end());
+	length = route.length;
+	++hits;
+	return true;
+}
+
+void RouteCache::reject(const RouteKey& key)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	Lookup::iterator found = index.find(key);
+	if (found != index.end())
+	{
+		entries.erase(found->second);
+		index.erase(found);
+	}
+
+	--hits;
+	++misses;
+}
+
+void RouteCache::insert(const RouteKey& key, const CachedRoute& route)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (limit == 0)
+	{
+		return;
+	}
+
+	Lookup::iterator found = index.find(key);
+	if (found != index.end())
+	{
+		found->second->second = route;
+		entries.splice(entries.begin(), entries, found->second);
+		return;
+	}
+
+	entries.push_front(std::make_pair(key, route));
+	index[key] = entries.begin();
+	if (entries.size() > limit)
+	{
+		index.erase(entries.back().first);
+		entries.pop_back();
+	}
+}
+
+void RouteCache::invalidate(const std::vector<bool>& dirty)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	for (Entries::iterator i = entries.begin(); i != entries.end();)
+	{
+		const std::vector<size_t>& blocks = i->second.blocks;
+		bool touched = false;
+		for (size_t b = 0; b < blocks.size() && !touched; ++b)
+		{
+			touched = blocks[b] < dirty.size() && dirty[blocks[b]];
+		}
+
+		if (touched)
+		{
+			index.erase(i->first);
+			i = entries.erase(i);
+			++invalidated;
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+void RouteCache::clear()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	entries.clear();
+	index.clear();
+}
+
+RouteCacheStats RouteCache::stats() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	RouteCacheStats result = { hits, misses, entries.size(), invalidated };
+	return result;
+}
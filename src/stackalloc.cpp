@@ -1,23 +1,226 @@
 #include "stackalloc.h"
+#include <algorithm>
+#include <cstdlib>
 #include <memory.h>
 #include <iostream>
+#include <mutex>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define HAVE_MMAP
+#endif
 
 namespace Engine
 {
 	//Stack Allocator
 	namespace Memory
 	{
-		StackAllocator::StackAllocator(size_t memoryBytes)
-			:avaliableSpace(((memoryBytes / 16) + 1) * 16)
+		namespace
+		{
+			static const size_t HugePage = 2 * 1024 * 1024;
+
+			std::mutex& registryLock()
+			{
+				static std::mutex lock;
+				return lock;
+			}
+
+			std::vector<const StackAllocator *>& registry()
+			{
+				static std::vector<const StackAllocator *> allocators;
+				return allocators;
+			}
+		}
+
+		//Sits at the start of the memory it describes, the allocations follow it.
+		struct StackAllocator::Chunk
 		{
+			Chunk * next;
+			Chunk * previous;
+
+			//Usable bytes, the bytes of the chunks before this one, and the length of its
+			//mapping, 0 when it came from malloc.
+			size_t bytes;
+			size_t offset;
+			size_t mapped;
+
+			boost::uint8_t * data()
+			{
+				return reinterpret_cast<boost::uint8_t *>(this) + HeaderBytes;
+			}
+
+			static const size_t HeaderBytes = 48;
+		};
+
+		StackAllocator::StackAllocator(size_t memoryBytes, unsigned flags)
+			:flags(flags)
+			,before(0)
+			,highest(0)
+			,capacity(0)
+			,chunks(0)
+			,owner(std::this_thread::get_id())
+		{
+			BOOST_STATIC_ASSERT(sizeof(Chunk) <= Chunk::HeaderBytes && Chunk::HeaderBytes % 16 == 0);
 			assert(memoryBytes > 0);
-			base = static_cast<boost::uint8_t *>(malloc(avaliableSpace));
+			first = createChunk(((memoryBytes / 16) + 1) * 16);
+			enter(first);
 			current = base;
+
+			if (flags & Reported)
+			{
+				std::lock_guard<std::mutex> hold(registryLock());
+				registry().push_back(this);
+			}
 		}
 
 		StackAllocator::~StackAllocator()
 		{
-			free(base);
+			if (flags & Reported)
+			{
+				std::lock_guard<std::mutex> hold(registryLock());
+				std::vector<const StackAllocator *>& all = registry();
+				all.erase(std::find(all.begin(), all.end(), this));
+			}
+
+			while (first)
+			{
+				Chunk * next = first->next;
+				destroyChunk(first);
+				first = next;
+			}
+		}
+
+		StackAllocator& StackAllocator::threadLocal()
+		{
+			static thread_local StackAllocator arena(64 * 1024, Growable | Reported);
+			return arena;
+		}
+
+		std::vector<StackUsage> StackAllocator::reportedUsage()
+		{
+			std::lock_guard<std::mutex> hold(registryLock());
+			std::vector<StackUsage> result;
+			const std::vector<const StackAllocator *>& all = registry();
+			for (size_t i = 0; i < all.size(); ++i)
+			{
+				result.push_back(all[i]->usage());
+			}
+
+			return result;
+		}
+
+		StackAllocator::Chunk * StackAllocator::createChunk(size_t bytes)
+		{
+			size_t total = Chunk::HeaderBytes + bytes;
+			void * memory = nullptr;
+			size_t mapped = 0;
+#ifdef HAVE_MMAP
+			if (flags & HugePages)
+			{
+				mapped = (total + HugePage - 1) / HugePage * HugePage;
+#ifdef MAP_HUGETLB
+				memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+				if (memory == MAP_FAILED)
+				{
+					memory = nullptr;
+				}
+#endif
+				//No reserved huge pages, ask for transparent ones instead.
+				if (!memory)
+				{
+					memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+					if (memory == MAP_FAILED)
+					{
+						memory = nullptr;
+					}
+#ifdef MADV_HUGEPAGE
+					else
+					{
+						madvise(memory, mapped, MADV_HUGEPAGE);
+					}
+#endif
+				}
+
+				if (memory)
+				{
+					bytes = mapped - Chunk::HeaderBytes;
+				}
+				else
+				{
+					mapped = 0;
+				}
+			}
+#endif
+			if (!memory)
+			{
+				memory = malloc(total);
+				if (!memory)
+				{
+					throw std::bad_alloc();
+				}
+			}
+
+			Chunk * result = static_cast<Chunk *>(memory);
+			result->next = nullptr;
+			result->previous = nullptr;
+			result->bytes = bytes;
+			result->offset = 0;
+			result->mapped = mapped;
+
+			capacity.fetch_add(bytes, std::memory_order_relaxed);
+			chunks.fetch_add(1, std::memory_order_relaxed);
+			return result;
+		}
+
+		void StackAllocator::destroyChunk(Chunk * chunk)
+		{
+#ifdef HAVE_MMAP
+			if (chunk->mapped)
+			{
+				munmap(chunk, chunk->mapped);
+				return;
+			}
+#endif
+			free(chunk);
+		}
+
+		void StackAllocator::enter(Chunk * c)
+		{
+			chunk = c;
+			base = c->data();
+			end = base + c->bytes;
+			before = c->offset;
+		}
+
+		//Moves on to a following chunk that fits the allocation, dropping those too small.
+		void StackAllocator::grow(size_t bytes)
+		{
+			if (!(flags & Growable))
+			{
+				throw std::bad_alloc();
+			}
+
+			Chunk * next = chunk->next;
+			while (next && next->bytes < bytes)
+			{
+				Chunk * after = next->next;
+				capacity.fetch_sub(next->bytes, std::memory_order_relaxed);
+				chunks.fetch_sub(1, std::memory_order_relaxed);
+				destroyChunk(next);
+				next = after;
+			}
+
+			if (!next)
+			{
+				next = createChunk(std::max(bytes, chunk->bytes * 2));
+			}
+
+			next->previous = chunk;
+			next->offset = chunk->offset + chunk->bytes;
+			chunk->next = next;
+			enter(next);
+			current = base;
 		}
 
 		StackAllocator::Mark StackAllocator::mark() 
@@ -27,7 +230,15 @@ namespace Engine
 
 		void StackAllocator::release(StackAllocator::Mark b)
 		{
-			current = reinterpret_cast<boost::uint8_t *>(b);
+			//Marks taken in earlier chunks step back to them, keeping the later ones for reuse.
+			boost::uint8_t * point = reinterpret_cast<boost::uint8_t *>(b);
+			while (point < base || point > end)
+			{
+				assert(chunk->previous);
+				enter(chunk->previous);
+			}
+
+			current = point;
 		}
 
 		const boost::uint8_t * StackAllocator::currentAllocation() const
@@ -38,11 +249,28 @@ namespace Engine
 		void StackAllocator::reset(boost::uint8_t * point)
 		{
 			current = point;
+			noteUsage();
 		}
 
 		size_t StackAllocator::remaining() const
 		{
-			return avaliableSpace - (current - base);
+			return end - current;
+		}
+
+		size_t StackAllocator::highWater() const
+		{
+			return highest.load(std::memory_order_relaxed);
+		}
+
+		void StackAllocator::resetHighWater()
+		{
+			highest.store(before + (current - base), std::memory_order_relaxed);
+		}
+
+		StackUsage StackAllocator::usage() const
+		{
+			StackUsage result = { owner, capacity.load(std::memory_order_relaxed), chunks.load(std::memory_order_relaxed), highWater() };
+			return result;
 		}
 	}
 
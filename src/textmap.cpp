@@ -0,0 +1,189 @@
+#include "textmap.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Pathfinder
+{
+	namespace
+	{
+#if defined(__AVX2__)
+		typedef __m256i Lanes;
+		static const size_t LaneCount = 32;
+
+		inline Lanes load(const char * p) { return _mm256_loadu_si256(reinterpret_cast<const Lanes *>(p)); }
+		inline void store(char * p, Lanes v) { _mm256_storeu_si256(reinterpret_cast<Lanes *>(p), v); }
+
+		//Bit i is set when character i of the group is a separator.
+		inline unsigned separators(Lanes v)
+		{
+			Lanes bar = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|'));
+			Lanes dash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'));
+			return static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(bar, dash)));
+		}
+#elif defined(__SSE2__)
+		typedef __m128i Lanes;
+		static const size_t LaneCount = 16;
+
+		inline Lanes load(const char * p) { return _mm_loadu_si128(reinterpret_cast<const Lanes *>(p)); }
+		inline void store(char * p, Lanes v) { _mm_storeu_si128(reinterpret_cast<Lanes *>(p), v); }
+
+		inline unsigned separators(Lanes v)
+		{
+			Lanes bar = _mm_cmpeq_epi8(v, _mm_set1_epi8('|'));
+			Lanes dash = _mm_cmpeq_epi8(v, _mm_set1_epi8('-'));
+			return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(bar, dash)));
+		}
+#else
+		static const size_t LaneCount = 1;
+#endif
+
+		inline bool isSeparator(char c)
+		{
+			return c == '|' || c == '-';
+		}
+
+		//Finds the line starting at text, without its newline or a '\r' before it.
+		//Returns the start of the next line.
+		const char * nextLine(const char * text, const char * end, const char *& lineEnd)
+		{
+			const char * newline = static_cast<const char *>(std::memchr(text, '\n', end - text));
+			lineEnd = newline ? newline : end;
+			if (lineEnd > text && lineEnd[-1] == '\r')
+			{
+				--lineEnd;
+			}
+
+			return newline ? newline + 1 : end;
+		}
+
+		size_t countTiles(const char * line, size_t length)
+		{
+			size_t tiles = length;
+			size_t x = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+			for (; x + LaneCount <= length; x += LaneCount)
+			{
+				for (unsigned found = separators(load(line + x)); found; found &= found - 1)
+				{
+					--tiles;
+				}
+			}
+#endif
+			for (; x < length; ++x)
+			{
+				tiles -= isSeparator(line[x]);
+			}
+
+			return tiles;
+		}
+
+		//Returns the end of the tiles written. Whole groups are stored while they fit before
+		//outEnd, the bytes past the tiles taken are overwritten by the tiles that follow.
+		char * copyTiles(const char * line, size_t length, char * out, char * outEnd)
+		{
+			size_t x = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+			while (x + LaneCount <= length && out + LaneCount <= outEnd)
+			{
+				Lanes group = load(line + x);
+				store(out, group);
+
+				unsigned found = separators(group);
+				if (!found)
+				{
+					out += LaneCount;
+					x += LaneCount;
+					continue;
+				}
+
+				//Keeps the tiles before the first separator and skips it.
+				size_t first = __builtin_ctz(found);
+				out += first;
+				x += first + 1;
+			}
+#endif
+			for (; x < length; ++x)
+			{
+				if (!isSeparator(line[x]))
+				{
+					*out++ = line[x];
+				}
+			}
+
+			return out;
+		}
+	}
+
+	bool measureTextMap(const char * text, size_t size, TextMapShape& shape, TextMapError * error)
+	{
+		shape.width = 0;
+		shape.height = 0;
+
+		const char * end = text + size;
+		size_t line = 0;
+		while (text < end)
+		{
+			const char * lineEnd;
+			const char * next = nextLine(text, end, lineEnd);
+			++line;
+
+			size_t tiles = countTiles(text, lineEnd - text);
+			text = next;
+			if (tiles == 0)
+			{
+				continue;
+			}
+
+			if (shape.height == 0)
+			{
+				shape.width = tiles;
+			}
+			else if (tiles != shape.width)
+			{
+				if (error)
+				{
+					error->line = line;
+					error->expected = shape.width;
+					error->found = tiles;
+				}
+
+				return false;
+			}
+
+			++shape.height;
+		}
+
+		if (shape.height == 0)
+		{
+			if (error)
+			{
+				error->line = 0;
+				error->expected = 0;
+				error->found = 0;
+			}
+
+			return false;
+		}
+
+		return true;
+	}
+
+	void readTextMap(const char * text, size_t size, const TextMapShape& shape, char * out)
+	{
+		char * outEnd = out + shape.width * shape.height;
+		const char * end = text + size;
+		while (text < end)
+		{
+			const char * lineEnd;
+			const char * next = nextLine(text, end, lineEnd);
+			out = copyTiles(text, lineEnd - text, out, outEnd);
+			text = next;
+		}
+	}
+}
@@ -0,0 +1,170 @@
+#include "workpool.h"
+
+#include <algorithm>
+
+namespace Engine
+{
+	namespace Threading
+	{
+		WorkStealingPool::WorkStealingPool(size_t threads)
+			:shares(threads ? threads : std::max<size_t>(std::thread::hardware_concurrency(), 1))
+			,task(nullptr)
+			,generation(0)
+			,running(0)
+			,stopping(false)
+		{
+			for (size_t i = 1; i < shares.size(); ++i)
+			{
+				workers.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+			}
+		}
+
+		WorkStealingPool::~WorkStealingPool()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+
+			wake.notify_all();
+			for (size_t i = 0; i < workers.size(); ++i)
+			{
+				workers[i].join();
+			}
+		}
+
+		size_t WorkStealingPool::threadCount() const
+		{
+			return shares.size();
+		}
+
+		void WorkStealingPool::parallelFor(size_t count, const std::function<void(size_t)>& work)
+		{
+			if (shares.size() == 1)
+			{
+				for (size_t i = 0; i < count; ++i)
+				{
+					work(i);
+				}
+
+				return;
+			}
+
+			for (size_t i = 0; i < shares.size(); ++i)
+			{
+				std::lock_guard<std::mutex> guard(shares[i].lock);
+				shares[i].begin = count * i / shares.size();
+				shares[i].end = count * (i + 1) / shares.size();
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				task = &work;
+				running = workers.size();
+				++generation;
+			}
+
+			wake.notify_all();
+			drain(0);
+
+			std::unique_lock<std::mutex> guard(lock);
+			done.wait(guard, [this] { return running == 0; });
+			task = nullptr;
+		}
+
+		void WorkStealingPool::workerLoop(size_t self)
+		{
+			size_t seen = 0;
+			for (;;)
+			{
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					wake.wait(guard, [this, seen] { return stopping || generation != seen; });
+					if (stopping)
+					{
+						return;
+					}
+
+					seen = generation;
+				}
+
+				drain(self);
+
+				std::lock_guard<std::mutex> guard(lock);
+				if (--running == 0)
+				{
+					done.notify_one();
+				}
+			}
+		}
+
+		void WorkStealingPool::drain(size_t self)
+		{
+			size_t index;
+			for (;;)
+			{
+				while (take(self, index))
+				{
+					(*task)(index);
+				}
+
+				if (!steal(self))
+				{
+					return;
+				}
+			}
+		}
+
+		bool WorkStealingPool::take(size_t self, size_t& index)
+		{
+			std::lock_guard<std::mutex> guard(shares[self].lock);
+			if (shares[self].begin == shares[self].end)
+			{
+				return false;
+			}
+
+			index = shares[self].begin++;
+			return true;
+		}
+
+		bool WorkStealingPool::steal(size_t self)
+		{
+			for (;;)
+			{
+				size_t victim = self;
+				size_t largest = 0;
+				for (size_t i = 0; i < shares.size(); ++i)
+				{
+					std::lock_guard<std::mutex> guard(shares[i].lock);
+					if (shares[i].end - shares[i].begin > largest)
+					{
+						largest = shares[i].end - shares[i].begin;
+						victim = i;
+					}
+				}
+
+				if (largest == 0)
+				{
+					return false;
+				}
+
+				std::lock(shares[self].lock, shares[victim].lock);
+				std::lock_guard<std::mutex> ownGuard(shares[self].lock, std::adopt_lock);
+				std::lock_guard<std::mutex> victimGuard(shares[victim].lock, std::adopt_lock);
+
+				//The victim may have made progress since it was picked.
+				size_t remaining = shares[victim].end - shares[victim].begin;
+				if (remaining == 0)
+				{
+					continue;
+				}
+
+				size_t half = (remaining + 1) / 2;
+				shares[self].begin = shares[victim].end - half;
+				shares[self].end = shares[victim].end;
+				shares[victim].end -= half;
+				return true;
+			}
+		}
+	}
+}
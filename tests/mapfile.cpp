@@ -0,0 +1,100 @@
+#define BOOST_TEST_MODULE Pathfinder
+#include <boost/test/unit_test.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "map.hpp"
+
+namespace
+{
+	//Land scattered with walls, water and mountains only air crosses.
+	std::string randomMap(size_t side, unsigned seed)
+	{
+		std::mt19937 random(seed);
+		std::string text;
+		for (size_t y = 0; y < side; ++y)
+		{
+			for (size_t x = 0; x < side; ++x)
+			{
+				unsigned r = random() % 100;
+				text += r < 15 ? '0' : r < 22 ? '~' : r < 26 ? '^' : '.';
+			}
+
+			text += '\n';
+		}
+
+		return text;
+	}
+
+	void preprocess(Map& map, const std::string& text, size_t threads)
+	{
+		std::istringstream in(text);
+		map.setThreads(threads);
+		map.loadFromStream(in);
+	}
+
+	std::string readFile(const char * path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(saved_file_does_not_depend_on_thread_count)
+{
+	std::string text = randomMap(128, 1);
+	Map single;
+	Map several;
+	preprocess(single, text, 1);
+	preprocess(several, text, 4);
+
+	BOOST_REQUIRE(single.save("single.hpa"));
+	BOOST_REQUIRE(several.save("several.hpa"));
+
+	std::string a = readFile("single.hpa");
+	std::string b = readFile("several.hpa");
+	BOOST_CHECK_EQUAL(a.size(), b.size());
+	BOOST_CHECK(a == b);
+
+	std::remove("single.hpa");
+	std::remove("several.hpa");
+}
+
+BOOST_AUTO_TEST_CASE(opened_file_answers_as_the_preprocessed_map)
+{
+	std::string text = randomMap(128, 2);
+	Map built;
+	preprocess(built, text, 2);
+	BOOST_REQUIRE(built.save("roundtrip.hpa"));
+
+	{
+		Map opened;
+		BOOST_REQUIRE(opened.openMapped("roundtrip.hpa"));
+		BOOST_REQUIRE_EQUAL(opened.columns(), built.columns());
+		BOOST_REQUIRE_EQUAL(opened.rows(), built.rows());
+
+		static const boost::uint8_t capabilities[] = { GROUND, WATER, AIR, GROUND | WATER, GROUND | WATER | AIR };
+		std::mt19937 random(3);
+		std::vector<Index> expected;
+		std::vector<Index> found;
+		for (size_t i = 0; i < 500; ++i)
+		{
+			OriginAndGoal query;
+			query.origin = Index(random() % built.columns(), random() % built.rows());
+			query.goal = Index(random() % built.columns(), random() % built.rows());
+			size_t size = 1 + random() % 3;
+			boost::uint8_t c = capabilities[random() % 5];
+
+			BOOST_CHECK_EQUAL(built.findPath(query, size, c, &expected), opened.findPath(query, size, c, &found));
+			BOOST_CHECK(expected == found);
+		}
+	}
+
+	std::remove("roundtrip.hpa");
+}